@@ -0,0 +1,129 @@
+/*
+
+AWI-Dyson-BMS - Dyson Battery Management System Configuration
+Copyright (C) 2025 AWi
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program. If not, see https://www.gnu.org/licenses/.
+Note: As an addendum to the GNU General Public License, any hardware
+using this project’s code or information must publicly disclose
+complete electrical schematics and a bill of materials for such hardware.
+Acknowledgements:
+Thanks to tinfever, the author of version 1, for compiling
+and open-sourcing it.
+Thanks to Dr. Mark Roberts for his contributions to the V8 open-source code.
+Contact: 112460193@qq.com | www.awi.design
+(Website is currently under maintenance) */
+
+#include "CellBalance.h"
+#include "isl94208.h"
+#include "LED.h"
+#include "StateMachine.h"
+#include "ChargeMonitor.h"
+
+/* Bleeds the high cells through the ISL balance switches while the charger is connected,
+ * either between charge pulses (CHARGING_WAIT) or once charging is complete.
+ *
+ * Each cycle the switches are on for BALANCE_ON_TICKS, then off for BALANCE_SETTLE_TICKS so
+ * the cells relax before the next acquisition. The cell readings are only taken in that window,
+ * and the next set of cells to bleed is picked from them.
+ *
+ * BALANCE_MAX_CYCLES is a budget for the whole charger connection, not for each entry. A pack that
+ * can't be brought under BALANCE_STOP_DELTA_mV uses it up once and then stays out of balancing
+ * until the charger is removed, instead of going back in from IDLE straight away.
+ */
+
+static bool balance_measuring = true;
+static uint8_t balance_cycles = 0;  // Cycles since the charger was connected
+
+static void _SetBalanceSwitches(uint8_t cell_mask) {
+    uint8_t switches = (cell_mask >> 1) & 0b00111111;  // Bit n of the mask is cell n, the register field starts at CB1
+    ISL_SetSpecificBits(ISL.CELL_BALANCE_6bits, switches);
+}
+
+static bool _BalanceTempOK(void) {
+    return (isl_int_temp < BALANCE_MAX_TEMP_C && thermistor_temp < BALANCE_MAX_TEMP_C);
+}
+
+bool cellBalanceWanted(void) {
+#ifdef ENABLE_CELL_BALANCING
+    return (detect == CHARGER
+        && balance_cycles < BALANCE_MAX_CYCLES
+        && (state == CHARGING_WAIT || charge_complete_flag)
+        && cellstats.packdelta_mV >= BALANCE_START_DELTA_mV
+        && cellstats.maxcell_mV >= BALANCE_MIN_CELL_mV
+        && _BalanceTempOK());
+#else
+    return false;
+#endif
+}
+
+void cellBalanceChargerRemoved(void) {
+    balance_cycles = 0;     // The budget starts over with the next connection
+}
+
+bool cellBalanceMeasurementDue(void) {
+    return (balance_measuring && balance_cycle_counter.value >= BALANCE_SETTLE_TICKS);
+}
+
+void cellBalanceEntry(void) {
+    _SetBalanceSwitches(0);
+    balance_measuring = true;
+    balance_cycle_counter.value = BALANCE_SETTLE_TICKS;     // Cells are already at rest, measure straight away
+    balance_cycle_counter.enable = true;
+    resetLEDBlinkPattern();
+#ifdef ENABLE_CHARGE_MONITOR
+    chargeMonitorBalancing();
+#endif
+}
+
+void cellBalance(void) {
+    Set_LED_RGB(0b011, 1023);
+
+    if (!balance_measuring) {
+        if (balance_cycle_counter.value >= BALANCE_ON_TICKS) {
+            _SetBalanceSwitches(0);
+            balance_measuring = true;
+            balance_cycle_counter.value = 0;
+        }
+        return;
+    }
+
+    if (!cellBalanceMeasurementDue()) {
+        return;     // Still settling
+    }
+
+    // Fresh readings were taken this pass with the switches off
+    if (cellstats.packdelta_mV <= BALANCE_STOP_DELTA_mV
+        || !_BalanceTempOK()
+        || ISL_GetSpecificBits_cached(ISL.INT_OVER_TEMP_STATUS)
+        || balance_cycles >= BALANCE_MAX_CYCLES
+    ) {
+        StateMachine_Event(COND_ACTION_DONE);
+        return;
+    }
+
+    uint8_t cell_mask = 0;
+    for (uint8_t cell = 1; cell <= 6; cell++) {
+        if (CellVoltages[cell] > cellstats.mincell_mV + BALANCE_STOP_DELTA_mV) {
+            cell_mask |= (uint8_t)(1 << cell);
+        }
+    }
+    _SetBalanceSwitches(cell_mask);
+    balance_measuring = false;
+    balance_cycle_counter.value = 0;
+    balance_cycles++;
+}
+
+void cellBalanceExit(void) {
+    _SetBalanceSwitches(0);
+    balance_cycle_counter.enable = false;
+    resetLEDBlinkPattern();
+}
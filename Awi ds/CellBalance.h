@@ -0,0 +1,38 @@
+/*
+
+AWI-Dyson-BMS - Dyson Battery Management System Configuration
+Copyright (C) 2025 AWi
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program. If not, see https://www.gnu.org/licenses/.
+Note: As an addendum to the GNU General Public License, any hardware
+using this project’s code or information must publicly disclose
+complete electrical schematics and a bill of materials for such hardware.
+Acknowledgements:
+Thanks to tinfever, the author of version 1, for compiling
+and open-sourcing it.
+Thanks to Dr. Mark Roberts for his contributions to the V8 open-source code.
+Contact: 112460193@qq.com | www.awi.design
+(Website is currently under maintenance) */
+
+#ifndef CELL_BALANCE_H
+#define CELL_BALANCE_H
+
+#include "main.h"
+#include "config.h"
+
+bool cellBalanceWanted(void);
+void cellBalanceChargerRemoved(void);
+bool cellBalanceMeasurementDue(void);
+void cellBalanceEntry(void);
+void cellBalance(void);
+void cellBalanceExit(void);
+
+#endif /* CELL_BALANCE_H */
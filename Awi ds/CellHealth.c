@@ -0,0 +1,143 @@
+/*
+
+AWI-Dyson-BMS - Dyson Battery Management System Configuration
+Copyright (C) 2025 AWi
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program. If not, see https://www.gnu.org/licenses/.
+Note: As an addendum to the GNU General Public License, any hardware
+using this project’s code or information must publicly disclose
+complete electrical schematics and a bill of materials for such hardware.
+Acknowledgements:
+Thanks to tinfever, the author of version 1, for compiling
+and open-sourcing it.
+Thanks to Dr. Mark Roberts for his contributions to the V8 open-source code.
+Contact: 112460193@qq.com | www.awi.design
+(Website is currently under maintenance) */
+
+
+#include "CellHealth.h"
+#include "EEPROMLog.h"
+#include "isl94208.h"
+
+#ifdef ENABLE_CELL_HEALTH_LOG
+
+/* Long term per-cell statistics. A weak cell shows up as a growing negative deviation at cutoff, a positive one at end
+ * of charge, a higher IR than its neighbours and a rank nibble that keeps filling while the others stay low.
+ * Snapshots are taken when a charge completes and when a discharge hits the undervoltage cutoff. Averages move a
+ * quarter of the way to each new sample. IR is estimated once per discharge from each cell's drop between the last
+ * idle scan and a loaded scan, after CELL_HEALTH_IR_SETTLE_SCANS scans above IR_STEP_MIN_mA.
+ */
+
+static uint16_t rest_mV[6];
+static uint8_t loaded_scans = 0xFF;     // 0xFF once this discharge's IR estimate is done
+
+static int16_t _Average(int16_t old, int16_t sample) {
+    int16_t diff = sample - old;
+    return old + (diff + ((diff > 0) ? 2 : -2)) / 4;
+}
+
+static uint8_t _CellAddr(uint8_t cell, uint8_t offset) {
+    return EEPROM_CELL_HEALTH_ADDR + (cell - 1) * CELL_HEALTH_CELL_SIZE + offset;
+}
+
+static void _CountRank(uint8_t cell, uint8_t shift) {
+    if (cell == 0) {
+        return;
+    }
+    uint8_t addr = _CellAddr(cell, CELL_HEALTH_RANKS);
+    if (((EEPROMLog_ReadByte(addr) >> shift) & 0x0F) >= CELL_HEALTH_RANK_MAX) {
+        for (uint8_t i = 1; i <= 6; i++) {
+            uint8_t ranks = EEPROMLog_ReadByte(_CellAddr(i, CELL_HEALTH_RANKS));
+            uint8_t count = (ranks >> shift) & 0x0F;
+            ranks = (uint8_t)((ranks & ~(0x0F << shift)) | ((count / 2) << shift));
+            EEPROMLog_WriteByte(_CellAddr(i, CELL_HEALTH_RANKS), ranks);
+        }
+    }
+    EEPROMLog_WriteByte(addr, (uint8_t)(EEPROMLog_ReadByte(addr) + (1 << shift)));
+}
+
+static bool _Snapshot(uint8_t dev_offset, uint8_t delta_base_offset) {
+    if (cellstats.pack_mV == 0) {
+        return false;   // No scan yet
+    }
+    int16_t mean_mV = (int16_t)(cellstats.pack_mV / 6);
+    for (uint8_t cell = 1; cell <= 6; cell++) {
+        int16_t dev = ((int16_t)CellVoltages[cell] - mean_mV) / 2;
+        if (dev > 127) {
+            dev = 127;
+        } else if (dev < -127) {
+            dev = -127;
+        }
+        uint8_t addr = _CellAddr(cell, dev_offset);
+        EEPROMLog_WriteByte(addr, (uint8_t)_Average((int8_t)EEPROMLog_ReadByte(addr), dev));
+    }
+
+    uint8_t delta = (cellstats.packdelta_mV >= 508) ? 254 : (uint8_t)(cellstats.packdelta_mV / 2);
+    uint8_t base_addr = EEPROM_CELL_HEALTH_ADDR + delta_base_offset;
+    if (EEPROMLog_ReadByte(base_addr) == 0xFF) {
+        EEPROMLog_WriteByte(base_addr, delta);
+        EEPROMLog_WriteByte(base_addr + 1, delta);
+    } else {
+        EEPROMLog_WriteByte(base_addr + 1, (uint8_t)_Average(EEPROMLog_ReadByte(base_addr + 1), delta));
+    }
+    return true;
+}
+
+void CellHealth_StartDischarge(void) {
+    for (uint8_t cell = 1; cell <= 6; cell++) {
+        rest_mV[cell - 1] = CellVoltages[cell];
+    }
+    loaded_scans = 0;
+}
+
+void CellHealth_Sample(bool scan_complete) {
+    if (!scan_complete || state != OUTPUT_EN || loaded_scans == 0xFF) {
+        return;
+    }
+    if (discharge_current_mA < IR_STEP_MIN_mA) {
+        loaded_scans = 0;   // The settle scans have to be at load
+        return;
+    }
+    if (++loaded_scans < CELL_HEALTH_IR_SETTLE_SCANS) {
+        return;
+    }
+    loaded_scans = 0xFF;
+    for (uint8_t cell = 1; cell <= 6; cell++) {
+        int32_t ir_mOhm = ((int32_t)rest_mV[cell - 1] - CellVoltages[cell]) * 1000 / discharge_current_mA;
+        if (ir_mOhm < IR_MIN_mOHM || ir_mOhm > IR_MAX_mOHM) {
+            continue;
+        }
+        uint8_t addr = _CellAddr(cell, CELL_HEALTH_IR);
+        uint8_t old = EEPROMLog_ReadByte(addr);
+        EEPROMLog_WriteByte(addr, (old == 0) ? (uint8_t)ir_mOhm : (uint8_t)_Average(old, (int16_t)ir_mOhm));
+    }
+}
+
+void CellHealth_Cutoff(void) {
+    if (_Snapshot(CELL_HEALTH_CUTOFF_DEV, CELL_HEALTH_CUTOFF_DELTA_BASE)) {
+        _CountRank(cellstats.mincellnum, 4);
+    }
+}
+
+void CellHealth_EndOfCharge(void) {
+    if (_Snapshot(CELL_HEALTH_EOC_DEV, CELL_HEALTH_EOC_DELTA_BASE)) {
+        _CountRank(cellstats.maxcellnum, 0);
+    }
+}
+
+void CellHealth_Format(void) {
+    for (uint8_t i = 0; i < CELL_HEALTH_SIZE; i++) {
+        bool baseline = (i == CELL_HEALTH_EOC_DELTA_BASE || i == CELL_HEALTH_CUTOFF_DELTA_BASE);
+        EEPROMLog_WriteByte(EEPROM_CELL_HEALTH_ADDR + i, baseline ? 0xFF : 0);
+    }
+}
+
+#endif
@@ -0,0 +1,60 @@
+/*
+
+AWI-Dyson-BMS - Dyson Battery Management System Configuration
+Copyright (C) 2025 AWi
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program. If not, see https://www.gnu.org/licenses/.
+Note: As an addendum to the GNU General Public License, any hardware
+using this project’s code or information must publicly disclose
+complete electrical schematics and a bill of materials for such hardware.
+Acknowledgements:
+Thanks to tinfever, the author of version 1, for compiling
+and open-sourcing it.
+Thanks to Dr. Mark Roberts for his contributions to the V8 open-source code.
+Contact: 112460193@qq.com | www.awi.design
+(Website is currently under maintenance) */
+
+
+#ifndef CELLHEALTH_H
+#define CELLHEALTH_H
+
+#include "main.h"
+#include "config.h"
+
+// EEPROM layout from EEPROM_CELL_HEALTH_ADDR. Per cell, CELL_HEALTH_CELL_SIZE bytes from cell 1:
+#define CELL_HEALTH_EOC_DEV 0           // int8, 2mV: average deviation from the pack mean at end of charge
+#define CELL_HEALTH_CUTOFF_DEV 1        // int8, 2mV: average deviation from the pack mean at the discharge cutoff
+#define CELL_HEALTH_IR 2                // uint8, mOhm: average internal resistance, 0 until the first estimate
+#define CELL_HEALTH_RANKS 3             // High nibble: times lowest cell at cutoff. Low nibble: times highest cell at end of charge.
+#define CELL_HEALTH_CELL_SIZE 4
+// Pack trend, packdelta_mV in 2mV units. Baselines are the first snapshot after formatting, 0xFF until then.
+#define CELL_HEALTH_PACK_OFFSET (6 * CELL_HEALTH_CELL_SIZE)
+#define CELL_HEALTH_EOC_DELTA_BASE (CELL_HEALTH_PACK_OFFSET + 0)
+#define CELL_HEALTH_EOC_DELTA_AVG (CELL_HEALTH_PACK_OFFSET + 1)
+#define CELL_HEALTH_CUTOFF_DELTA_BASE (CELL_HEALTH_PACK_OFFSET + 2)
+#define CELL_HEALTH_CUTOFF_DELTA_AVG (CELL_HEALTH_PACK_OFFSET + 3)
+#define CELL_HEALTH_SIZE (CELL_HEALTH_PACK_OFFSET + 4)     // The trend's cycle count is the histograms' HIST_CYCLES_OFFSET
+
+#define CELL_HEALTH_RANK_MAX 15         // All nibbles of a kind are halved when one would pass this
+
+#ifdef ENABLE_CELL_VOLTAGE_ROLLING_AVERAGE
+#define CELL_HEALTH_IR_SETTLE_SCANS CELLVOLTAGE_AVERAGE_WINDOW_SIZE     // Loaded scans before the averages hold no rest samples
+#else
+#define CELL_HEALTH_IR_SETTLE_SCANS 1
+#endif
+
+void CellHealth_StartDischarge(void);
+void CellHealth_Sample(bool scan_complete);
+void CellHealth_Cutoff(void);
+void CellHealth_EndOfCharge(void);
+void CellHealth_Format(void);
+
+#endif /* CELLHEALTH_H */
@@ -0,0 +1,192 @@
+/*
+
+AWI-Dyson-BMS - Dyson Battery Management System Configuration
+Copyright (C) 2025 AWi
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program. If not, see https://www.gnu.org/licenses/.
+Note: As an addendum to the GNU General Public License, any hardware
+using this project’s code or information must publicly disclose
+complete electrical schematics and a bill of materials for such hardware.
+Acknowledgements:
+Thanks to tinfever, the author of version 1, for compiling
+and open-sourcing it.
+Thanks to Dr. Mark Roberts for his contributions to the V8 open-source code.
+Contact: 112460193@qq.com | www.awi.design
+(Website is currently under maintenance) */
+
+#include "ChargeMonitor.h"
+#include "mcc_generated_files/mcc.h"
+#include "isl94208.h"
+#include "FaultHandling.h"
+#include "LED.h"
+#include "EEPROMLog.h"
+
+/* There is no charge current sense path: the ISL only compares the charge shunt against its OC threshold and the PIC
+ * shunt only sees discharge current. Charge current is estimated from the pack voltage step when the charge FET closes,
+ * divided by the cell resistance learned during discharge (see updateCellResistance()).
+ *
+ * Time to full comes from the rise rate of the top cell during the constant current part of the charge, plus a fixed
+ * allowance for the pulse charging at the limit.
+ *
+ * A session runs from the first pulse until the charge completes, the charger is removed or the error state is entered,
+ * and leaves one record in a EEPROM_CHARGE_RECORD_SLOTS ring. Balancing that starts after a completed charge, with the charger
+ * still connected, is added to that session's record.
+ */
+
+charge_session_t charge_session = {false, 0, 0, TTF_UNKNOWN};
+
+static uint16_t pulse_rest_mV = 0;
+static bool pulse_step_done = false;
+static uint16_t ttf_last_sample_mV = 0;
+static uint32_t ttf_next_sample_tick = 0;
+static uint8_t record_start_min = 0;
+static uint8_t record_start_max = 0;
+static uint8_t record_wait_pulses = 0;
+static int8_t record_peak_temp_C = -128;
+static bool record_balanced = false;
+static uint8_t open_record_addr = 0;    // Record of a completed session while its charger stays connected, 0 otherwise
+
+static void _TrackTemperature(void) {
+    int16_t temp = (isl_int_temp > thermistor_temp) ? isl_int_temp : thermistor_temp;
+    if (temp > record_peak_temp_C) {
+        record_peak_temp_C = (temp > 127) ? 127 : (int8_t)temp;
+    }
+}
+
+// Overwrites the older slot. The sequence byte is cleared first and written last, so a torn record reads as empty.
+static void _WriteRecord(charge_end_t reason, uint16_t minutes) {
+    uint8_t seq0 = EEPROMLog_ReadByte(EEPROM_CHARGE_RECORD_ADDR + CHARGE_RECORD_SEQ);
+    uint8_t seq1 = EEPROMLog_ReadByte(EEPROM_CHARGE_RECORD_ADDR + CHARGE_RECORD_SIZE + CHARGE_RECORD_SEQ);
+    uint8_t newest_seq = seq0;
+    uint8_t slot = 1;
+    if (seq0 == 0xFF || (seq1 != 0xFF && seq1 == (seq0 + 1) % 0xFF)) {
+        newest_seq = seq1;
+        slot = 0;
+    }
+    uint8_t seq = (newest_seq == 0xFF) ? 0 : (uint8_t)((newest_seq + 1) % 0xFF);
+    uint8_t addr = EEPROM_CHARGE_RECORD_ADDR + slot * CHARGE_RECORD_SIZE;
+
+    if (minutes > 0x0FFF) {
+        minutes = 0x0FFF;
+    }
+    uint8_t flags = (uint8_t)(reason << 6) | (uint8_t)(minutes >> 8);
+    if (record_balanced) {
+        flags |= CHARGE_RECORD_BALANCED;
+    }
+    EEPROMLog_WriteByte(addr + CHARGE_RECORD_SEQ, 0xFF);
+    EEPROMLog_WriteByte(addr + CHARGE_RECORD_START_MINCELL, record_start_min);
+    EEPROMLog_WriteByte(addr + CHARGE_RECORD_START_MAXCELL, record_start_max);
+    EEPROMLog_WriteByte(addr + CHARGE_RECORD_END_MINCELL, EEPROMLog_CellCode(cellstats.mincell_mV));
+    EEPROMLog_WriteByte(addr + CHARGE_RECORD_END_MAXCELL, EEPROMLog_CellCode(cellstats.maxcell_mV));
+    EEPROMLog_WriteByte(addr + CHARGE_RECORD_FLAGS, flags);
+    EEPROMLog_WriteByte(addr + CHARGE_RECORD_MINUTES, (uint8_t)minutes);
+    EEPROMLog_WriteByte(addr + CHARGE_RECORD_WAIT_PULSES, record_wait_pulses);
+    EEPROMLog_WriteByte(addr + CHARGE_RECORD_PEAK_TEMP, (uint8_t)record_peak_temp_C);
+    EEPROMLog_WriteByte(addr + CHARGE_RECORD_SEQ, seq);
+
+    open_record_addr = (reason == CHARGE_END_COMPLETE) ? addr : 0;
+}
+
+void chargeMonitorPulseStart(void) {
+    if (!charge_session.active) {
+        charge_session = (charge_session_t){true, 0, 0, TTF_UNKNOWN};
+        charge_session_counter.value = 0;
+        charge_session_counter.enable = true;
+        record_start_min = EEPROMLog_CellCode(cellstats.mincell_mV);    //Rest voltages, the FET has only just been closed
+        record_start_max = EEPROMLog_CellCode(cellstats.maxcell_mV);
+        record_wait_pulses = 0;
+        record_peak_temp_C = -128;
+        record_balanced = false;
+        open_record_addr = 0;
+    }
+    pulse_rest_mV = cellstats.pack_mV;     //Last reading with the FET open
+    pulse_step_done = false;
+    ttf_last_sample_mV = 0;
+    ttf_next_sample_tick = 0;
+}
+
+void chargeMonitorUpdate(void) {
+    _TrackTemperature();
+    if (!pulse_step_done && charge_duration_counter.value >= CHARGE_ISENSE_STEP_TICKS) {
+        pulse_step_done = true;
+        uint16_t cell_ir = (cell_ir_mOhm != 0) ? cell_ir_mOhm : CHARGE_ISENSE_DEFAULT_IR_mOHM;
+        uint16_t step_mV = (cellstats.pack_mV > pulse_rest_mV) ? (cellstats.pack_mV - pulse_rest_mV) : 0;
+        uint32_t current_mA = (uint32_t)step_mV * 1000 / (6u * cell_ir);
+        charge_session.current_mA = (current_mA > 0xFFFF) ? 0xFFFF : (uint16_t)current_mA;
+        if (charge_session.current_mA > charge_session.peak_current_mA) {
+            charge_session.peak_current_mA = charge_session.current_mA;
+        }
+    }
+
+    if (charge_session.time_to_full_min == 0 || charge_duration_counter.value < ttf_next_sample_tick) {
+        return;
+    }
+    ttf_next_sample_tick = charge_duration_counter.value + TTF_SAMPLE_TICKS;
+
+    uint16_t top_mV = cellstats.maxcell_mV;
+    if (ttf_last_sample_mV != 0 && top_mV > ttf_last_sample_mV && top_mV < MAX_CHARGE_CELL_VOLTAGE_mV) {
+        uint32_t samples_left = (MAX_CHARGE_CELL_VOLTAGE_mV - top_mV) / (top_mV - ttf_last_sample_mV);
+        uint32_t minutes = samples_left * TTF_SAMPLE_TICKS / 1875 + TTF_TOP_OF_CHARGE_MIN;   //1875 ticks per minute
+        charge_session.time_to_full_min = (minutes >= TTF_UNKNOWN) ? TTF_UNKNOWN - 1 : (uint8_t)minutes;
+    }
+    ttf_last_sample_mV = top_mV;
+}
+
+void chargeMonitorTopOfCharge(void) {
+    charge_session.time_to_full_min = 0;
+    if (record_wait_pulses < 0xFF) {
+        record_wait_pulses++;
+    }
+    _TrackTemperature();
+}
+
+void chargeMonitorBalancing(void) {
+    if (charge_session.active) {
+        record_balanced = true;
+    } else if (open_record_addr != 0) {
+        uint8_t flags_addr = open_record_addr + CHARGE_RECORD_FLAGS;
+        EEPROMLog_WriteByte(flags_addr, EEPROMLog_ReadByte(flags_addr) | CHARGE_RECORD_BALANCED);
+    }
+}
+
+void chargeMonitorSessionEnd(charge_end_t reason) {
+    if (!charge_session.active) {
+        if (reason != CHARGE_END_COMPLETE) {
+            open_record_addr = 0;   // Charger gone or error, later balancing belongs to no session
+        }
+        return;
+    }
+    charge_session.active = false;
+    charge_session_counter.enable = false;
+
+    uint32_t minutes = charge_session_counter.value / 1875;
+    uint16_t current_50mA = charge_session.peak_current_mA / 50;
+    EEPROMLog_WriteByte(EEPROM_LAST_CHARGE_SESSION_ADDR, (current_50mA > 0xFF) ? 0xFF : (uint8_t)current_50mA);
+    EEPROMLog_WriteByte(EEPROM_LAST_CHARGE_SESSION_ADDR+1, (minutes > 0xFF) ? 0xFF : (uint8_t)minutes);
+    _TrackTemperature();
+    _WriteRecord(reason, (minutes > 0xFFFF) ? 0xFFFF : (uint16_t)minutes);
+}
+
+// One blink per 10 minutes left, up to 9. Returns false while the estimate is unknown so the caller can show solid blue.
+bool chargeTimeToFullLED(void) {
+    if (charge_session.time_to_full_min == TTF_UNKNOWN) {
+        return false;
+    }
+    uint8_t blinks = (uint8_t)(charge_session.time_to_full_min / 10 + 1);
+    ledBlinkpattern((blinks > 9) ? 9 : blinks, 0b001, 300, 300, 0, 1500, 0);
+    return true;
+}
+
+void chargeMonitorFormat(void) {
+    for (uint8_t i = 0; i < EEPROM_CHARGE_RECORD_SLOTS * CHARGE_RECORD_SIZE; i++) {
+        EEPROMLog_WriteByte(EEPROM_CHARGE_RECORD_ADDR + i, 0xFF);
+    }
+}
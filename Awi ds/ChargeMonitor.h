@@ -0,0 +1,70 @@
+/*
+
+AWI-Dyson-BMS - Dyson Battery Management System Configuration
+Copyright (C) 2025 AWi
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program. If not, see https://www.gnu.org/licenses/.
+Note: As an addendum to the GNU General Public License, any hardware
+using this project’s code or information must publicly disclose
+complete electrical schematics and a bill of materials for such hardware.
+Acknowledgements:
+Thanks to tinfever, the author of version 1, for compiling
+and open-sourcing it.
+Thanks to Dr. Mark Roberts for his contributions to the V8 open-source code.
+Contact: 112460193@qq.com | www.awi.design
+(Website is currently under maintenance) */
+
+#ifndef CHARGE_MONITOR_H
+#define CHARGE_MONITOR_H
+
+#include "main.h"
+#include "config.h"
+
+#define TTF_UNKNOWN 0xFF
+
+// Charge session record layout from EEPROM_CHARGE_RECORD_ADDR, EEPROM_CHARGE_RECORD_SLOTS slots
+#define CHARGE_RECORD_SIZE 9
+#define CHARGE_RECORD_SEQ 0             // 0-254, wraps. 0xFF while the slot is empty or being rewritten, so it is written last.
+#define CHARGE_RECORD_START_MINCELL 1   // Cells at the first pulse and at the end, EVENT_CELL_STEP_mV steps above EVENT_CELL_BASE_mV
+#define CHARGE_RECORD_START_MAXCELL 2
+#define CHARGE_RECORD_END_MINCELL 3
+#define CHARGE_RECORD_END_MAXCELL 4
+#define CHARGE_RECORD_FLAGS 5           // charge_end_t in bits 7-6, CHARGE_RECORD_BALANCED, minutes bits 11-8 in bits 3-0
+#define CHARGE_RECORD_MINUTES 6         // Session duration bits 7-0, saturating at 4095
+#define CHARGE_RECORD_WAIT_PULSES 7     // CHARGING_WAIT entries, saturating
+#define CHARGE_RECORD_PEAK_TEMP 8       // Hotter of the two temperatures, Celsius, signed
+#define CHARGE_RECORD_BALANCED 0x20     // Cell balancing ran while the charger was connected
+
+typedef enum {
+    CHARGE_END_COMPLETE = 0,
+    CHARGE_END_REMOVED = 1,         // Charger removed before completion
+    CHARGE_END_TEMPERATURE = 2,     // Error state with a temperature reason
+    CHARGE_END_FAULT = 3            // Any other error
+} charge_end_t;
+
+typedef struct {
+    bool active;                //A charger session is running, from the first pulse until IDLE or ERROR
+    uint16_t current_mA;        //Estimated from the pack voltage step at the start of the latest pulse. 0 until then.
+    uint16_t peak_current_mA;
+    uint8_t time_to_full_min;   //TTF_UNKNOWN until two rise rate samples, 0 once the pack is pulse charging at the limit
+} charge_session_t;
+
+extern charge_session_t charge_session;
+
+void chargeMonitorPulseStart(void);
+void chargeMonitorUpdate(void);
+void chargeMonitorTopOfCharge(void);
+void chargeMonitorBalancing(void);
+void chargeMonitorSessionEnd(charge_end_t reason);
+void chargeMonitorFormat(void);
+bool chargeTimeToFullLED(void);
+
+#endif /* CHARGE_MONITOR_H */
@@ -0,0 +1,544 @@
+/*
+
+AWI-Dyson-BMS - Dyson Battery Management System Configuration
+Copyright (C) 2025 AWi
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program. If not, see https://www.gnu.org/licenses/.
+Note: As an addendum to the GNU General Public License, any hardware
+using this project’s code or information must publicly disclose
+complete electrical schematics and a bill of materials for such hardware.
+Acknowledgements:
+Thanks to tinfever, the author of version 1, for compiling
+and open-sourcing it.
+Thanks to Dr. Mark Roberts for his contributions to the V8 open-source code.
+Contact: 112460193@qq.com | www.awi.design
+(Website is currently under maintenance) */
+
+#include "EEPROMLog.h"
+#include "main.h"
+#include "isl94208.h"
+#include "Histograms.h"
+#include "CellHealth.h"
+#include "ChargeMonitor.h"
+#include "mcc_generated_files/mcc.h"
+
+/* Runtime journal. total_runtime_counter used to be rewritten in place at 0x1C-0x1F on every OUTPUT_EN exit and error.
+ * It is now kept as two checkpoints followed by a ring of one byte deltas:
+ *
+ *   checkpoint: seq, runtime (4 bytes, MSB first), ring start | lap << 7, CRC-8
+ *   delta:      lap << 7 | runtime since the previous entry in RUNTIME_JOURNAL_TICKS_PER_DELTA units (1-127)
+ *
+ * An update appends one delta byte. A checkpoint is written to the older slot instead when the delta doesn't fit in
+ * 7 bits or the ring is full. The lap bit flips every time the ring wraps, so recovery adds up deltas from the
+ * checkpoint's ring start until it reaches one left over from the previous lap. A torn checkpoint fails its CRC and the
+ * other slot is used. Up to one delta unit of runtime is lost over a reset.
+ */
+
+/* Write queue. DATAEE_WriteByte() spins for the whole 4-5ms of every byte. Writes are queued here instead and started
+ * one at a time from EEPROMLog_Service() once the previous one has finished, so the loop keeps running while a record
+ * is logged. Bytes are written in the order they were queued, so a record always lands before the pointer that
+ * publishes it. Reads check the queue and the byte being written first, so they see the newest value without waiting.
+ * Bytes that already hold their value are dropped when they leave the queue, to save the wear. Only a full queue blocks.
+ */
+
+static uint8_t queue_addr[EEPROM_WRITE_QUEUE_LENGTH];
+static uint8_t queue_data[EEPROM_WRITE_QUEUE_LENGTH];
+static uint8_t queue_head = 0;
+static uint8_t queue_count = 0;
+static uint8_t write_addr;      // Byte in progress while EECON1bits.WR is set
+static uint8_t write_data;
+
+static void _StartWrite(uint8_t addr, uint8_t data) {
+    EEADRL = addr;
+    EEDATL = data;
+    EECON1bits.CFGS = 0;
+    EECON1bits.EEPGD = 0;
+    EECON1bits.WREN = 1;
+
+    bool interrupts_enabled = INTCONbits.GIE;
+    INTCONbits.GIE = 0;     // Required unlock sequence
+    EECON2 = 0x55;
+    EECON2 = 0xAA;
+    EECON1bits.WR = 1;
+    INTCONbits.GIE = interrupts_enabled;
+}
+
+bool EEPROMLog_Service(void) {
+    if (EECON1bits.WR) {
+        return true;
+    }
+    EECON1bits.WREN = 0;
+    while (queue_count != 0) {
+        uint8_t addr = queue_addr[queue_head];
+        uint8_t data = queue_data[queue_head];
+        queue_head = (queue_head + 1) % EEPROM_WRITE_QUEUE_LENGTH;
+        queue_count--;
+        if (DATAEE_ReadByte(addr) != data) {    // Earlier writes to addr have all finished, so this is current
+            write_addr = addr;
+            write_data = data;
+            _StartWrite(addr, data);
+            return true;
+        }
+    }
+    return false;
+}
+
+void EEPROMLog_Flush(void) {
+    while (EEPROMLog_Service()) {
+        CLRWDT();
+    }
+}
+
+uint8_t EEPROMLog_ReadByte(uint8_t addr) {
+    for (uint8_t i = queue_count; i > 0; i--) {
+        uint8_t index = (queue_head + i - 1) % EEPROM_WRITE_QUEUE_LENGTH;
+        if (queue_addr[index] == addr) {
+            return queue_data[index];
+        }
+    }
+    if (EECON1bits.WR) {
+        if (addr == write_addr) {
+            return write_data;
+        }
+        while (EECON1bits.WR) {}    // EEADRL belongs to the write in progress until it finishes
+    }
+    return DATAEE_ReadByte(addr);
+}
+
+void EEPROMLog_WriteByte(uint8_t addr, uint8_t data) {
+    while (queue_count >= EEPROM_WRITE_QUEUE_LENGTH) {
+        EEPROMLog_Service();
+    }
+    uint8_t index = (queue_head + queue_count) % EEPROM_WRITE_QUEUE_LENGTH;
+    queue_addr[index] = addr;
+    queue_data[index] = data;
+    queue_count++;
+    EEPROMLog_Service();
+}
+
+#define JOURNAL_CHECKPOINT_SIZE 7
+#define JOURNAL_RING_ADDR (EEPROM_RUNTIME_JOURNAL_ADDR + 2 * JOURNAL_CHECKPOINT_SIZE)
+#define JOURNAL_LAP_BIT 0x80
+
+static uint32_t journal_persisted_ticks = 0;    // What recovery would return right now
+static uint8_t journal_seq = 0;
+static uint8_t journal_slot = 1;                // Slot of the newest checkpoint
+static uint8_t journal_ring_index = 0;          // Next delta goes here
+static uint8_t journal_lap = 0;
+static uint8_t journal_count = 0;               // Deltas since the newest checkpoint
+
+uint8_t EEPROMLog_CRC8(const uint8_t *data, uint8_t length) {
+    uint8_t crc = 0;
+    while (length--) {
+        crc ^= *data++;
+        for (uint8_t bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ 0x07) : (uint8_t)(crc << 1);
+        }
+    }
+    return crc;
+}
+
+static bool _ReadCheckpoint(uint8_t slot, uint8_t *checkpoint) {
+    uint8_t addr = (uint8_t)(EEPROM_RUNTIME_JOURNAL_ADDR + slot * JOURNAL_CHECKPOINT_SIZE);
+    for (uint8_t i = 0; i < JOURNAL_CHECKPOINT_SIZE; i++) {
+        checkpoint[i] = EEPROMLog_ReadByte(addr + i);
+    }
+    return EEPROMLog_CRC8(checkpoint, JOURNAL_CHECKPOINT_SIZE - 1) == checkpoint[JOURNAL_CHECKPOINT_SIZE - 1];
+}
+
+static void _WriteCheckpoint(uint32_t runtime_ticks) {
+    uint8_t checkpoint[JOURNAL_CHECKPOINT_SIZE];
+    journal_slot ^= 1;
+    journal_seq++;
+    checkpoint[0] = journal_seq;
+    checkpoint[1] = (uint8_t)(runtime_ticks >> 24);
+    checkpoint[2] = (uint8_t)(runtime_ticks >> 16);
+    checkpoint[3] = (uint8_t)(runtime_ticks >> 8);
+    checkpoint[4] = (uint8_t)runtime_ticks;
+    checkpoint[5] = journal_ring_index | journal_lap;
+    checkpoint[6] = EEPROMLog_CRC8(checkpoint, JOURNAL_CHECKPOINT_SIZE - 1);
+
+    uint8_t addr = (uint8_t)(EEPROM_RUNTIME_JOURNAL_ADDR + journal_slot * JOURNAL_CHECKPOINT_SIZE);
+    for (uint8_t i = 0; i < JOURNAL_CHECKPOINT_SIZE; i++) {
+        EEPROMLog_WriteByte(addr + i, checkpoint[i]);
+    }
+    journal_persisted_ticks = runtime_ticks;
+    journal_count = 0;
+}
+
+// Layout 0 had the runtime counter at 0x1C. Carry it over into a cleared journal.
+static void _FormatJournal(void) {
+    uint32_t legacy_ticks = (uint32_t) EEPROMLog_ReadByte(EEPROM_RUNTIME_TOTAL_STARTING_ADDR) << 24;
+    legacy_ticks |= (uint32_t) EEPROMLog_ReadByte(EEPROM_RUNTIME_TOTAL_STARTING_ADDR+1) << 16;
+    legacy_ticks |= (uint32_t) EEPROMLog_ReadByte(EEPROM_RUNTIME_TOTAL_STARTING_ADDR+2) << 8;
+    legacy_ticks |= (uint32_t) EEPROMLog_ReadByte(EEPROM_RUNTIME_TOTAL_STARTING_ADDR+3);
+
+    for (uint8_t i = 0; i < EEPROM_RUNTIME_JOURNAL_RING_SIZE; i++) {
+        EEPROMLog_WriteByte(JOURNAL_RING_ADDR + i, 0xFF);  // Lap bit set, the first lap writes it clear
+    }
+    for (uint8_t i = 0; i < JOURNAL_CHECKPOINT_SIZE; i++) {
+        EEPROMLog_WriteByte(EEPROM_RUNTIME_JOURNAL_ADDR + JOURNAL_CHECKPOINT_SIZE + i, (i == JOURNAL_CHECKPOINT_SIZE - 1) ? 0xFF : 0);  // Bad CRC
+    }
+    journal_slot = 1;
+    journal_seq = 0;
+    journal_ring_index = 0;
+    journal_lap = 0;
+    _WriteCheckpoint(legacy_ticks);     // Slot 0
+}
+
+uint32_t EEPROMLog_RecoverRuntime(void) {
+    uint8_t slot_a[JOURNAL_CHECKPOINT_SIZE];
+    uint8_t slot_b[JOURNAL_CHECKPOINT_SIZE];
+    bool a_valid = _ReadCheckpoint(0, slot_a);
+    bool b_valid = _ReadCheckpoint(1, slot_b);
+    if (!a_valid && !b_valid) {
+        _FormatJournal();   // Both torn, fall back to the legacy counter
+        return journal_persisted_ticks;
+    }
+
+    uint8_t *checkpoint = slot_b;
+    journal_slot = 1;
+    if (a_valid && (!b_valid || (int8_t)(slot_a[0] - slot_b[0]) > 0)) {
+        checkpoint = slot_a;
+        journal_slot = 0;
+    }
+    journal_seq = checkpoint[0];
+    uint32_t runtime_ticks = (uint32_t)checkpoint[1] << 24 | (uint32_t)checkpoint[2] << 16 | (uint16_t)checkpoint[3] << 8 | checkpoint[4];
+    journal_ring_index = checkpoint[5] & ~JOURNAL_LAP_BIT;
+    journal_lap = checkpoint[5] & JOURNAL_LAP_BIT;
+    if (journal_ring_index >= EEPROM_RUNTIME_JOURNAL_RING_SIZE) {
+        journal_ring_index = 0;
+    }
+
+    for (journal_count = 0; journal_count < EEPROM_RUNTIME_JOURNAL_RING_SIZE; journal_count++) {
+        uint8_t delta = EEPROMLog_ReadByte(JOURNAL_RING_ADDR + journal_ring_index);
+        if ((delta & JOURNAL_LAP_BIT) != journal_lap || (delta & ~JOURNAL_LAP_BIT) == 0) {
+            break;
+        }
+        runtime_ticks += (uint32_t)(delta & ~JOURNAL_LAP_BIT) * RUNTIME_JOURNAL_TICKS_PER_DELTA;
+        if (++journal_ring_index >= EEPROM_RUNTIME_JOURNAL_RING_SIZE) {
+            journal_ring_index = 0;
+            journal_lap ^= JOURNAL_LAP_BIT;
+        }
+    }
+    journal_persisted_ticks = runtime_ticks;
+    return runtime_ticks;
+}
+
+void EEPROMLog_CommitRuntime(uint32_t runtime_ticks) {
+    if (runtime_ticks <= journal_persisted_ticks) {
+        return;
+    }
+    uint32_t units = (runtime_ticks - journal_persisted_ticks) / RUNTIME_JOURNAL_TICKS_PER_DELTA;
+    if (units > 0x7F || journal_count >= EEPROM_RUNTIME_JOURNAL_RING_SIZE) {
+        _WriteCheckpoint(runtime_ticks);
+        return;
+    }
+    if (units == 0) {
+        return;     // Carried over to the next update
+    }
+
+    EEPROMLog_WriteByte(JOURNAL_RING_ADDR + journal_ring_index, journal_lap | (uint8_t)units);
+    journal_persisted_ticks += units * RUNTIME_JOURNAL_TICKS_PER_DELTA;
+    journal_count++;
+    if (++journal_ring_index >= EEPROM_RUNTIME_JOURNAL_RING_SIZE) {
+        journal_ring_index = 0;
+        journal_lap ^= JOURNAL_LAP_BIT;
+    }
+}
+
+/* Event history, a compact stream in EEPROM_EVENT_STREAM_BLOCKS blocks of EEPROM_EVENT_BLOCK_SIZE bytes from
+ * EEPROM_START_OF_EVENT_LOGS_ADDR. The oldest block is reused when the newest one is full, so the blocks before the
+ * newest one are always complete.
+ *
+ *   block:  seq (7 bits), runtime base in RUNTIME_JOURNAL_TICKS_PER_DELTA units (4 bytes, MSB first), entries
+ *   entry:  00 dd bbbb            one fault flag, bit number b, detect mode d, then the runtime delta
+ *           01 dd 0000 hi lo      any other fault word, then the runtime delta
+ *           10 nnnnnn             the previous fault repeated n more times, counted up in place
+ *           11111111              end of the block's entries
+ *
+ * Runtime deltas are LEB128 varints against the previous entry in the block, or the block base for the first one.
+ * A new entry writes the end marker after itself first and its header byte last, so a torn entry is never read.
+ *
+ * The newest full details sit in EVENT_DETAIL_SLOTS records of EVENT_RECORD_SIZE bytes from EEPROM_EVENT_DETAIL_ADDR
+ * (offsets in EEPROMLog.h). A torn record fails its CRC. init() picks up the next slot and sequence number from the
+ * newest valid record. Repeats only bump the stream count and leave the detail record of the first one in place.
+ */
+
+#define EVENT_BLOCK_HEADER_SIZE 5
+#define EVENT_STREAM_END 0xFF
+#define EVENT_KIND_MASK 0xC0
+#define EVENT_KIND_FLAG 0x00
+#define EVENT_KIND_WORD 0x40
+#define EVENT_KIND_REPEAT 0x80
+#define EVENT_REPEAT_MAX 0x3F
+#define EVENT_DETAIL_SLOTS ((EEPROM_END_OF_EVENT_LOGS_ADDR - EEPROM_EVENT_DETAIL_ADDR + 1) / EVENT_RECORD_SIZE)
+#define EVENT_BLOCK_ADDR(block) ((uint8_t)(EEPROM_START_OF_EVENT_LOGS_ADDR + (block) * EEPROM_EVENT_BLOCK_SIZE))
+
+static uint8_t event_seq = 0;
+static uint8_t detail_next_slot = 0;
+static uint8_t stream_block = 0;            // Block being appended to
+static uint8_t stream_block_seq = 0;
+static uint8_t stream_next_addr = 0;        // Where the next entry goes, holds the end marker
+static uint8_t stream_last_entry_addr = 0;  // 0 when the block has no entries yet
+static uint32_t stream_last_units = 0;      // Runtime of the last entry, the delta base for the next
+static error_reason_t stream_last_reason = 0;
+
+uint8_t EEPROMLog_CellCode(uint16_t cell_mV) {
+    if (cell_mV <= EVENT_CELL_BASE_mV) {
+        return 0;
+    }
+    uint16_t code = (cell_mV - EVENT_CELL_BASE_mV) / EVENT_CELL_STEP_mV;
+    return (code > 0xFF) ? 0xFF : (uint8_t)code;
+}
+
+static int8_t _TempCode(int16_t temp_C) {
+    if (temp_C > INT8_MAX) {
+        return INT8_MAX;
+    }
+    return (temp_C < INT8_MIN) ? INT8_MIN : (int8_t)temp_C;
+}
+
+bool EEPROMLog_ReadEvent(uint8_t slot, uint8_t *record) {
+    uint8_t addr = (uint8_t)(EEPROM_EVENT_DETAIL_ADDR + slot * EVENT_RECORD_SIZE);
+    for (uint8_t i = 0; i < EVENT_RECORD_SIZE; i++) {
+        record[i] = EEPROMLog_ReadByte(addr + i);
+    }
+    return (record[EVENT_HEADER] >> 4) == EVENT_RECORD_VERSION
+        && EEPROMLog_CRC8(record, EVENT_RECORD_SIZE - 1) == record[EVENT_CRC];
+}
+
+static void _LogEventDetail(error_reason_t reason, state_t fault_state) {
+    uint8_t record[EVENT_RECORD_SIZE];
+    uint32_t uptime_min = uptime_counter.value / 1875;
+    uint16_t peak_current = peak_discharge_current_mA / EVENT_CURRENT_STEP_mA;
+
+    record[EVENT_HEADER] = (uint8_t)(EVENT_RECORD_VERSION << 4 | (fault_state & 0x0F));
+    record[EVENT_SEQ] = event_seq++;
+    record[EVENT_REASON] = (uint8_t)(reason >> 8);
+    record[EVENT_REASON+1] = (uint8_t)reason;
+    record[EVENT_RUNTIME] = (uint8_t)(total_runtime_counter.value >> 24);
+    record[EVENT_RUNTIME+1] = (uint8_t)(total_runtime_counter.value >> 16);
+    record[EVENT_RUNTIME+2] = (uint8_t)(total_runtime_counter.value >> 8);
+    record[EVENT_RUNTIME+3] = (uint8_t)total_runtime_counter.value;
+    record[EVENT_UPTIME] = (uptime_min > 0xFF) ? 0xFF : (uint8_t)uptime_min;
+    record[EVENT_MINCELL] = EEPROMLog_CellCode(cellstats.mincell_mV);
+    record[EVENT_MAXCELL] = EEPROMLog_CellCode(cellstats.maxcell_mV);
+    record[EVENT_CELLNUMS] = (uint8_t)(cellstats.mincellnum << 4 | (cellstats.maxcellnum & 0x0F));
+    record[EVENT_ISL_TEMP] = (uint8_t)_TempCode(isl_int_temp);
+    record[EVENT_THERMISTOR_TEMP] = (uint8_t)_TempCode(thermistor_temp);
+    record[EVENT_PEAK_CURRENT] = (peak_current > 0xFF) ? 0xFF : (uint8_t)peak_current;
+    record[EVENT_CRC] = EEPROMLog_CRC8(record, EVENT_RECORD_SIZE - 1);
+
+    uint8_t addr = (uint8_t)(EEPROM_EVENT_DETAIL_ADDR + detail_next_slot * EVENT_RECORD_SIZE);
+    for (uint8_t i = 0; i < EVENT_RECORD_SIZE; i++) {
+        EEPROMLog_WriteByte(addr + i, record[i]);
+    }
+    detail_next_slot = (detail_next_slot + 1) % EVENT_DETAIL_SLOTS;
+}
+
+static void _StartBlock(uint32_t base_units) {
+    stream_block = (stream_block + 1) % EEPROM_EVENT_STREAM_BLOCKS;
+    stream_block_seq = (stream_block_seq + 1) & 0x7F;
+    uint8_t addr = EVENT_BLOCK_ADDR(stream_block);
+    EEPROMLog_WriteByte(addr + EVENT_BLOCK_HEADER_SIZE, EVENT_STREAM_END);   // Drop the old entries before the new base
+    EEPROMLog_WriteByte(addr + 1, (uint8_t)(base_units >> 24));
+    EEPROMLog_WriteByte(addr + 2, (uint8_t)(base_units >> 16));
+    EEPROMLog_WriteByte(addr + 3, (uint8_t)(base_units >> 8));
+    EEPROMLog_WriteByte(addr + 4, (uint8_t)base_units);
+    EEPROMLog_WriteByte(addr, stream_block_seq);
+    stream_next_addr = addr + EVENT_BLOCK_HEADER_SIZE;
+    stream_last_entry_addr = 0;
+    stream_last_units = base_units;
+}
+
+static uint8_t _PutVarint(uint8_t *out, uint32_t value) {
+    uint8_t length = 0;
+    do {
+        out[length] = value & 0x7F;
+        value >>= 7;
+        if (value != 0) {
+            out[length] |= 0x80;
+        }
+        length++;
+    } while (value != 0);
+    return length;
+}
+
+static void _LogEventStream(error_reason_t reason) {
+    bool repeat = (stream_last_entry_addr != 0 && reason == stream_last_reason);
+    if (repeat) {
+        uint8_t last = EEPROMLog_ReadByte(stream_last_entry_addr);
+        if ((last & EVENT_KIND_MASK) == EVENT_KIND_REPEAT && (last & ~EVENT_KIND_MASK) < EVENT_REPEAT_MAX) {
+            EEPROMLog_WriteByte(stream_last_entry_addr, last + 1);
+            return;
+        }
+    }
+
+    uint8_t entry[8];
+    uint8_t length = 0;
+    uint8_t block_end = EVENT_BLOCK_ADDR(stream_block) + EEPROM_EVENT_BLOCK_SIZE;
+    if (repeat && stream_next_addr < block_end) {
+        entry[length++] = EVENT_KIND_REPEAT | 1;    // The old count is full
+    } else {
+        // A repeat that doesn't fit is logged in full, so no block starts with a repeat of a fault it doesn't hold
+        error_reason_t faults = reason & ~ERR_DETECT_MODE_MASK;    // Any single reason bit, including the ones below ERR_FAULT_MASK
+        uint8_t detect_bits = (uint8_t)((reason & ERR_DETECT_MODE_MASK) << 4);
+        if (faults != 0 && (faults & (faults - 1)) == 0) {
+            uint8_t bit = 0;
+            while (!(faults & 1)) {
+                faults >>= 1;
+                bit++;
+            }
+            entry[length++] = EVENT_KIND_FLAG | detect_bits | bit;
+        } else {
+            entry[length++] = EVENT_KIND_WORD | detect_bits;
+            entry[length++] = (uint8_t)(reason >> 8);
+            entry[length++] = (uint8_t)(reason & ~ERR_DETECT_MODE_MASK);
+        }
+
+        uint32_t units = total_runtime_counter.value / RUNTIME_JOURNAL_TICKS_PER_DELTA;
+        uint32_t delta = (units > stream_last_units) ? units - stream_last_units : 0;
+        uint8_t header_length = length;
+        length += _PutVarint(&entry[header_length], delta);
+        if (stream_next_addr == 0 || stream_next_addr + length > block_end) {
+            _StartBlock(units);
+            block_end = EVENT_BLOCK_ADDR(stream_block) + EEPROM_EVENT_BLOCK_SIZE;
+            length = header_length + _PutVarint(&entry[header_length], 0);
+        }
+        stream_last_units = units;
+    }
+
+    if (stream_next_addr + length < block_end) {
+        EEPROMLog_WriteByte(stream_next_addr + length, EVENT_STREAM_END);
+    }
+    for (uint8_t i = length; i > 0; i--) {
+        EEPROMLog_WriteByte(stream_next_addr + i - 1, entry[i - 1]);    // Header last publishes the entry
+    }
+    stream_last_entry_addr = stream_next_addr;
+    stream_next_addr += length;
+    stream_last_reason = reason;
+}
+
+void EEPROMLog_LogEvent(error_reason_t reason, state_t fault_state) {
+    bool repeat = (stream_last_entry_addr != 0 && reason == stream_last_reason);
+    _LogEventStream(reason);
+    if (!repeat) {
+        _LogEventDetail(reason, fault_state);
+    }
+}
+
+static void _RecoverStream(void) {
+    bool found = false;
+    for (uint8_t block = 0; block < EEPROM_EVENT_STREAM_BLOCKS; block++) {
+        uint8_t seq = EEPROMLog_ReadByte(EVENT_BLOCK_ADDR(block));
+        if (seq > 0x7F) {
+            continue;   // Never used
+        }
+        if (!found || (int8_t)((uint8_t)(seq - stream_block_seq) << 1) > 0) {
+            found = true;
+            stream_block = block;
+            stream_block_seq = seq;
+        }
+    }
+    if (!found) {
+        stream_block = EEPROM_EVENT_STREAM_BLOCKS - 1;  // The first event starts block 0
+        stream_block_seq = 0x7F;
+        stream_next_addr = 0;
+        return;
+    }
+
+    uint8_t addr = EVENT_BLOCK_ADDR(stream_block);
+    uint8_t block_end = addr + EEPROM_EVENT_BLOCK_SIZE;
+    stream_last_units = (uint32_t)EEPROMLog_ReadByte(addr + 1) << 24 | (uint32_t)EEPROMLog_ReadByte(addr + 2) << 16
+            | (uint16_t)EEPROMLog_ReadByte(addr + 3) << 8 | EEPROMLog_ReadByte(addr + 4);
+    stream_last_entry_addr = 0;
+    addr += EVENT_BLOCK_HEADER_SIZE;
+
+    while (addr < block_end) {
+        uint8_t header = EEPROMLog_ReadByte(addr);
+        if (header == EVENT_STREAM_END) {
+            break;
+        }
+        stream_last_entry_addr = addr++;
+        if ((header & EVENT_KIND_MASK) == EVENT_KIND_REPEAT) {
+            continue;
+        }
+        error_reason_t detect_mode = (header >> 4) & ERR_DETECT_MODE_MASK;
+        if ((header & EVENT_KIND_MASK) == EVENT_KIND_FLAG) {
+            stream_last_reason = (error_reason_t)(1u << (header & 0x0F)) | detect_mode;
+        } else {
+            stream_last_reason = (error_reason_t)((uint16_t)EEPROMLog_ReadByte(addr) << 8 | EEPROMLog_ReadByte(addr + 1)) | detect_mode;
+            addr += 2;
+        }
+        uint32_t delta = 0;
+        uint8_t shift = 0;
+        uint8_t varint_byte;
+        do {
+            varint_byte = EEPROMLog_ReadByte(addr++);
+            delta |= (uint32_t)(varint_byte & 0x7F) << shift;
+            shift += 7;
+        } while ((varint_byte & 0x80) && addr < block_end && shift < 32);
+        stream_last_units += delta;
+    }
+    stream_next_addr = (addr > block_end) ? block_end : addr;
+}
+
+static void _RecoverEvents(void) {
+    uint8_t record[EVENT_RECORD_SIZE];
+    bool found = false;
+    for (uint8_t slot = 0; slot < EVENT_DETAIL_SLOTS; slot++) {
+        if (EEPROMLog_ReadEvent(slot, record) && (!found || (int8_t)(record[EVENT_SEQ] - event_seq) >= 0)) {
+            found = true;
+            detail_next_slot = (slot + 1) % EVENT_DETAIL_SLOTS;
+            event_seq = record[EVENT_SEQ];
+        }
+    }
+    if (found) {
+        event_seq++;
+    }
+    _RecoverStream();
+}
+
+// Layout 0 kept its fault records here. Mark every stream block unused and every detail record invalid.
+static void _FormatEvents(void) {
+    for (uint8_t block = 0; block < EEPROM_EVENT_STREAM_BLOCKS; block++) {
+        EEPROMLog_WriteByte(EVENT_BLOCK_ADDR(block), 0xFF);
+    }
+    for (uint8_t slot = 0; slot < EVENT_DETAIL_SLOTS; slot++) {
+        EEPROMLog_WriteByte((uint8_t)(EEPROM_EVENT_DETAIL_ADDR + slot * EVENT_RECORD_SIZE + EVENT_HEADER), 0xFF);
+    }
+}
+
+// Any other version is the original firmware's layout 0. Every region is formatted, carrying its runtime counter over
+// into the journal. A build with other EEPROM options moves the regions, so they are formatted again, keeping the
+// journal. The version is written last so a torn format reruns.
+void EEPROMLog_Init(void) {
+    bool legacy = (EEPROMLog_ReadByte(EEPROM_LAYOUT_VERSION_ADDR) != EEPROM_LAYOUT_VERSION);
+    if (legacy || EEPROMLog_ReadByte(EEPROM_LAYOUT_FEATURES_ADDR) != EEPROM_LAYOUT_FEATURES) {
+        if (legacy) {
+            _FormatJournal();
+        }
+        _FormatEvents();
+#ifdef ENABLE_USAGE_HISTOGRAMS
+        Histograms_Format();
+#endif
+#ifdef ENABLE_CELL_HEALTH_LOG
+        CellHealth_Format();
+#endif
+#ifdef ENABLE_CHARGE_MONITOR
+        chargeMonitorFormat();
+#endif
+        EEPROMLog_WriteByte(EEPROM_LAYOUT_FEATURES_ADDR, EEPROM_LAYOUT_FEATURES);
+        EEPROMLog_WriteByte(EEPROM_LAYOUT_VERSION_ADDR, EEPROM_LAYOUT_VERSION);
+    }
+    _RecoverEvents();
+}
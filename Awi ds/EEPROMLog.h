@@ -0,0 +1,65 @@
+/*
+
+AWI-Dyson-BMS - Dyson Battery Management System Configuration
+Copyright (C) 2025 AWi
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program. If not, see https://www.gnu.org/licenses/.
+Note: As an addendum to the GNU General Public License, any hardware
+using this project’s code or information must publicly disclose
+complete electrical schematics and a bill of materials for such hardware.
+Acknowledgements:
+Thanks to tinfever, the author of version 1, for compiling
+and open-sourcing it.
+Thanks to Dr. Mark Roberts for his contributions to the V8 open-source code.
+Contact: 112460193@qq.com | www.awi.design
+(Website is currently under maintenance) */
+
+#ifndef EEPROM_LOG_H
+#define EEPROM_LOG_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "config.h"
+#include "main.h"
+
+// Event record layout, byte offsets
+#define EVENT_RECORD_VERSION 1
+#define EVENT_RECORD_SIZE 16
+#define EVENT_HEADER 0              // Record version in the high nibble, state at the fault in the low nibble
+#define EVENT_SEQ 1                 // Increments per record, wraps at 255
+#define EVENT_REASON 2              // error_reason_t, MSB first
+#define EVENT_RUNTIME 4             // total_runtime_counter ticks, MSB first
+#define EVENT_UPTIME 8              // Minutes since power on, saturating
+#define EVENT_MINCELL 9             // EVENT_CELL_STEP_mV steps above EVENT_CELL_BASE_mV
+#define EVENT_MAXCELL 10
+#define EVENT_CELLNUMS 11           // Min cell number in the high nibble, max cell number in the low nibble
+#define EVENT_ISL_TEMP 12           // Celsius, signed
+#define EVENT_THERMISTOR_TEMP 13
+#define EVENT_PEAK_CURRENT 14       // Peak discharge current since the discharge FET was last enabled, EVENT_CURRENT_STEP_mA steps
+#define EVENT_CRC 15                // CRC-8 (poly 0x07, init 0) of bytes 0-14
+
+#define EVENT_CELL_BASE_mV 2000
+#define EVENT_CELL_STEP_mV 10
+#define EVENT_CURRENT_STEP_mA 250
+
+uint8_t EEPROMLog_CRC8(const uint8_t *data, uint8_t length);
+uint8_t EEPROMLog_CellCode(uint16_t cell_mV);
+bool EEPROMLog_Service(void);
+void EEPROMLog_Flush(void);
+uint8_t EEPROMLog_ReadByte(uint8_t addr);
+void EEPROMLog_WriteByte(uint8_t addr, uint8_t data);
+void EEPROMLog_Init(void);
+uint32_t EEPROMLog_RecoverRuntime(void);
+void EEPROMLog_CommitRuntime(uint32_t runtime_ticks);
+bool EEPROMLog_ReadEvent(uint8_t slot, uint8_t *record);
+void EEPROMLog_LogEvent(error_reason_t reason, state_t fault_state);
+
+#endif /* EEPROM_LOG_H */
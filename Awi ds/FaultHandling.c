@@ -22,87 +22,377 @@ Thanks to Dr. Mark Roberts for his contributions to the V8 open-source code.
 Contact: 112460193@qq.com | www.awi.design
 (Website is currently under maintenance) */
 
+#include "mcc_generated_files/mcc.h"
 #include "FaultHandling.h"
 #include "config.h"
 #include "isl94208.h"
+#include "LED.h"
 
-bool safetyChecks(void) {
-    bool result = true;
-    result &= (isl_int_temp < MAX_DISCHARGE_TEMP_C);
-    result &= (thermistor_temp < MAX_DISCHARGE_TEMP_C);
-    result &= (isl_int_temp > MIN_TEMP_C);
-    result &= (thermistor_temp > MIN_TEMP_C);
-    result &= (ISL_RegData[Status] == 0);
-    result &= (discharge_current_mA < MAX_DISCHARGE_CURRENT_mA);
-    
-    if (!result && state != ERROR) {
+safety_status_t safety = {0, 0, true, true, true};
+
+/* N-of-M debounce per fault over 32ms ticks. Each acquisition shifts the raw fault bit into a history byte, one bit per
+ * tick since the previous acquisition. Ticks without an acquisition count as clear, and acquisitions within the same
+ * tick share its bit. The fault only reaches safety.faults once it is set in "required" of the last "window" ticks.
+ * Until then faultsPending() asks for an acquisition every tick, so the idle states confirm it as fast as the others.
+ * Faults not listed here act on the first sample.
+ */
+static const fault_filter_t fault_filters[] = {
+    {FAULT_ISL_STATUS,                  ISL_STATUS_FAULT_REQUIRED,  ISL_STATUS_FAULT_WINDOW},
+    {FAULT_DISCHARGE_OC_SHUNT,          SHUNT_OC_FAULT_REQUIRED,    SHUNT_OC_FAULT_WINDOW},
+    {FAULT_ISL_INT_OVERTEMP,            TEMP_FAULT_REQUIRED,        TEMP_FAULT_WINDOW},
+    {FAULT_THERMISTOR_OVERTEMP,         TEMP_FAULT_REQUIRED,        TEMP_FAULT_WINDOW},
+    {FAULT_UNDERTEMP,                   TEMP_FAULT_REQUIRED,        TEMP_FAULT_WINDOW},
+    {FAULT_ISL_INT_CHARGE_OVERTEMP,     TEMP_FAULT_REQUIRED,        TEMP_FAULT_WINDOW},
+    {FAULT_THERMISTOR_CHARGE_OVERTEMP,  TEMP_FAULT_REQUIRED,        TEMP_FAULT_WINDOW},
+};
+
+#define NUM_OF_FAULT_FILTERS (sizeof(fault_filters) / sizeof(fault_filters[0]))
+
+static uint8_t fault_history[NUM_OF_FAULT_FILTERS] = {0};   //Bit 0 is the latest tick
+static uint32_t fault_history_tick = 0;     //uptime_counter at the latest sample
+static bool fault_pending = false;          //A filter has seen its fault but not acted on it yet
+static uint8_t fault_isl_status = 0;    //Status register from the latest sample that had FAULT_ISL_STATUS set
+
+static uint8_t _RawFaults(void) {
+    uint8_t faults = 0;
+
+    if (ISL_GetSpecificBits_cached(ISL.SHORT_CIRCUIT_STATUS)) {
+        faults |= FAULT_ISL_SHORT_CIRCUIT;
+    }
+    if ((ISL_RegData[Status] & (uint8_t)~(1u << ISL.SHORT_CIRCUIT_STATUS[1])) != 0) {
+        faults |= FAULT_ISL_STATUS;
+        fault_isl_status = ISL_RegData[Status];
+    }
+    if (discharge_current_mA >= MAX_DISCHARGE_CURRENT_mA || cellstats.overcurrent) {     //The sample that aborted the scan counts even if a later read is lower
+        faults |= FAULT_DISCHARGE_OC_SHUNT;
+    }
+    if (isl_int_temp >= MAX_DISCHARGE_TEMP_C) {
+        faults |= FAULT_ISL_INT_OVERTEMP;
+    }
+    if (thermistor_temp >= MAX_DISCHARGE_TEMP_C) {
+        faults |= FAULT_THERMISTOR_OVERTEMP;
+    }
+    if (isl_int_temp <= MIN_TEMP_C || thermistor_temp <= MIN_TEMP_C) {
+        faults |= FAULT_UNDERTEMP;
+    }
+    if (isl_int_temp >= MAX_CHARGE_TEMP_C) {
+        faults |= FAULT_ISL_INT_CHARGE_OVERTEMP;
+    }
+    if (thermistor_temp >= MAX_CHARGE_TEMP_C) {
+        faults |= FAULT_THERMISTOR_CHARGE_OVERTEMP;
+    }
+    return faults;
+}
+
+static uint8_t _DebounceFaults(uint8_t raw_faults) {
+    uint8_t faults = raw_faults;
+    uint32_t elapsed = uptime_counter.value - fault_history_tick;
+    uint8_t shift = (elapsed > 8) ? 8 : (uint8_t)elapsed;
+    fault_history_tick = uptime_counter.value;
+    fault_pending = false;
+
+    for (uint8_t i = 0; i < NUM_OF_FAULT_FILTERS; i++) {
+        const fault_filter_t *filter = &fault_filters[i];
+        fault_history[i] = (uint8_t)(fault_history[i] << shift) | ((raw_faults & filter->fault) ? 1 : 0);
+
+        uint8_t window = fault_history[i] & (uint8_t)(0xFF >> (8 - filter->window));
+        uint8_t count = 0;
+        while (window) {
+            count += window & 1;
+            window >>= 1;
+        }
+        if (count < filter->required) {
+            faults &= (uint8_t)~filter->fault;
+            if (count != 0) {
+                fault_pending = true;
+            }
+        }
+    }
+    return faults;
+}
+
+bool faultsPending(void) {
+    return fault_pending;
+}
+
+/* Reasons behind the debounced verdict. A fault can pass its filter on samples the latest one no longer shows,
+ * so the raw readings setErrorReasonFlags() works from may be back in range on the pass that latches them.
+ */
+static error_reason_t _FaultReasons(uint8_t faults) {
+    error_reason_t reasons = 0;
+
+    if (faults & FAULT_ISL_SHORT_CIRCUIT) {
+        reasons |= ERR_DISCHARGE_SC_FLAG;
+    }
+    if (faults & FAULT_ISL_STATUS) {
+        if (fault_isl_status & (1u << ISL.INT_OVER_TEMP_STATUS[1])) {
+            reasons |= ERR_ISL_INT_OVERTEMP_FLAG;
+        }
+        if (fault_isl_status & (1u << ISL.EXT_OVER_TEMP_STATUS[1])) {
+            reasons |= ERR_ISL_EXT_OVERTEMP_FLAG;
+        }
+        if (fault_isl_status & (1u << ISL.OC_CHARGE_STATUS[1])) {
+            reasons |= ERR_CHARGE_OC_FLAG;
+        }
+        if (fault_isl_status & (1u << ISL.OC_DISCHARGE_STATUS[1])) {
+            reasons |= ERR_DISCHARGE_OC_FLAG;
+        }
+    }
+    if (faults & FAULT_DISCHARGE_OC_SHUNT) {
+        reasons |= ERR_DISCHARGE_OC_SHUNT_PICREAD;
+    }
+    if (faults & FAULT_ISL_INT_OVERTEMP) {
+        reasons |= ERR_ISL_INT_OVERTEMP_PICREAD;
+    }
+    if (faults & FAULT_THERMISTOR_OVERTEMP) {
+        reasons |= ERR_THERMISTOR_OVERTEMP_PICREAD;
+    }
+    if (faults & FAULT_UNDERTEMP) {
+        reasons |= ERR_UNDERTEMP_FLAG;
+    }
+    if (state == CHARGING && (faults & FAULT_ISL_INT_CHARGE_OVERTEMP)) {
+        reasons |= ERR_CHARGE_ISL_INT_OVERTEMP_PICREAD;
+    }
+    if (state == CHARGING && (faults & FAULT_THERMISTOR_CHARGE_OVERTEMP)) {
+        reasons |= ERR_CHARGE_THERMISTOR_OVERTEMP_PICREAD;
+    }
+    return reasons;
+}
+
+void evaluateSafety(bool new_sample) {     //Called once per loop. State handlers read the verdicts from safety instead of re-checking the limits.
+    if (new_sample) {
+        safety.raw_faults = _RawFaults();
+        safety.faults = _DebounceFaults(safety.raw_faults);
+        safety.temp_ok = ((safety.faults & FAULT_TEMP_MASK) == 0);
+        safety.discharge_ok = ((safety.faults & FAULT_DISCHARGE_MASK) == 0);
+        safety.charge_ok = ((safety.faults & FAULT_CHARGE_MASK) == 0);
+    }
+
+#ifdef ENABLE_COMPARATOR_OC_TRIP
+    if (comparator_oc_tripped) {    // The cutoff write is pending or sent, act on it without waiting for the shunt debounce
+        safety.faults |= FAULT_DISCHARGE_OC_SHUNT;
+        safety.discharge_ok = false;
+        safety.charge_ok = false;
+    }
+#endif
+
+    // Latch the reasons once, on the pass that will take us to ERROR. Charge temperature limits only apply while charging.
+    if (state != ERROR && state != CRITICAL_ERROR && (!safety.discharge_ok || (state == CHARGING && !safety.charge_ok))) {
         setErrorReasonFlags(&past_error_reason);
+        past_error_reason |= _FaultReasons(safety.faults);
+    }
+}
+
+uint8_t cell_ir_mOhm = 0;   //Per cell, including its share of the pack wiring. 0 until the first load step.
+
+/* Estimates cell resistance from the change in unaveraged cell voltage across a change in
+ * discharge current between two full scans, e.g. trigger pull or motor speed change.
+ */
+void updateCellResistance(bool scan_complete) {
+#ifdef ENABLE_IR_COMPENSATED_CUTOFF
+    static uint16_t last_pack_mV = 0;
+    static uint16_t last_current_mA = 0;
+
+    if (!scan_complete) {
+        return;
+    }
+    if (last_pack_mV != 0) {
+        int32_t delta_mA = (int32_t)discharge_current_mA - last_current_mA;
+        int32_t delta_mV = (int32_t)last_pack_mV - cellstats.pack_raw_mV;     //Voltage falls as current rises
+        if (delta_mA >= IR_STEP_MIN_mA || delta_mA <= -IR_STEP_MIN_mA) {
+            int32_t ir_mOhm = delta_mV * 1000 / 6 / delta_mA;
+            if (ir_mOhm >= IR_MIN_mOHM && ir_mOhm <= IR_MAX_mOHM) {
+                if (cell_ir_mOhm == 0) {
+                    cell_ir_mOhm = (uint8_t)ir_mOhm;
+                } else {
+                    cell_ir_mOhm = (uint8_t)(cell_ir_mOhm + (ir_mOhm - cell_ir_mOhm) / 4);
+                }
+            }
+        }
     }
-    
-    return result;
+    last_pack_mV = cellstats.pack_raw_mV;
+    last_current_mA = discharge_current_mA;
+#endif
+}
+
+uint16_t minCellCutoff_mV(void) {     //Loaded cell voltage that corresponds to MIN_DISCHARGE_CELL_VOLTAGE_mV open circuit
+#ifdef ENABLE_IR_COMPENSATED_CUTOFF
+    uint32_t drop_mV = (uint32_t)discharge_current_mA * cell_ir_mOhm / 1000;
+    if (drop_mV > MAX_IR_COMPENSATION_mV) {
+        drop_mV = MAX_IR_COMPENSATION_mV;
+    }
+    uint16_t cutoff_mV = MIN_DISCHARGE_CELL_VOLTAGE_mV - (uint16_t)drop_mV;
+    if (cutoff_mV < MIN_LOADED_CELL_VOLTAGE_mV) {
+        cutoff_mV = MIN_LOADED_CELL_VOLTAGE_mV;
+    }
+    return cutoff_mV;
+#else
+    return MIN_DISCHARGE_CELL_VOLTAGE_mV;
+#endif
 }
 
 bool minCellOK(void) {
-    return (cellstats.mincell_mV > MIN_DISCHARGE_CELL_VOLTAGE_mV);
+    return !cellstats.below_cutoff;     //Checked cell by cell in the scan, each against the current of its own reading
 }
 
 bool maxCellOK(void) {
     return (cellstats.maxcell_mV < MAX_CHARGE_CELL_VOLTAGE_mV);
 }
 
-bool chargeTempCheck(void) {
-    bool result = true;
-    result &= (isl_int_temp < MAX_CHARGE_TEMP_C);
-    result &= (thermistor_temp < MAX_CHARGE_TEMP_C);
-    result &= (isl_int_temp > MIN_TEMP_C);
-    result &= (thermistor_temp > MIN_TEMP_C);
-    
-    if (!result && state != ERROR) {
-        setErrorReasonFlags(&past_error_reason);
-    }
-    return result;
+void updateDischargeReadyFlag(void) {     //Called after every acquisition so a trigger edge can be acted on without waiting for the next one
+    discharge_ready_flag = (minCellOK() && !full_discharge_flag && (safety.raw_faults & FAULT_DISCHARGE_MASK) == 0);
+    discharge_ready_age_counter.value = 0;
+    discharge_ready_age_counter.enable = true;
+}
+
+bool dischargeReady(void) {
+    return (discharge_ready_flag && discharge_ready_age_counter.value <= DISCHARGE_READY_MAX_AGE);
 }
 
 void setErrorReasonFlags(volatile error_reason_t *datastore) {
-    datastore->ISL_INT_OVERTEMP_FLAG = ISL_GetSpecificBits_cached(ISL.INT_OVER_TEMP_STATUS);
-    datastore->ISL_EXT_OVERTEMP_FLAG = ISL_GetSpecificBits_cached(ISL.EXT_OVER_TEMP_STATUS);
-    datastore->ISL_INT_OVERTEMP_PICREAD = (isl_int_temp >= MAX_DISCHARGE_TEMP_C);
-    datastore->THERMISTOR_OVERTEMP_PICREAD = (thermistor_temp >= MAX_DISCHARGE_TEMP_C);
-    datastore->UNDERTEMP_FLAG = (isl_int_temp <= MIN_TEMP_C || thermistor_temp <= MIN_TEMP_C);
-    datastore->CHARGE_OC_FLAG = ISL_GetSpecificBits_cached(ISL.OC_CHARGE_STATUS);
-    datastore->DISCHARGE_OC_FLAG = ISL_GetSpecificBits_cached(ISL.OC_DISCHARGE_STATUS);
-    datastore->DISCHARGE_SC_FLAG = ISL_GetSpecificBits_cached(ISL.SHORT_CIRCUIT_STATUS);
-    datastore->DISCHARGE_OC_SHUNT_PICREAD = (discharge_current_mA >= MAX_DISCHARGE_CURRENT_mA);
-    datastore->CHARGE_ISL_INT_OVERTEMP_PICREAD = (state == CHARGING && isl_int_temp >= MAX_CHARGE_TEMP_C);
-    datastore->CHARGE_THERMISTOR_OVERTEMP_PICREAD = (state == CHARGING && thermistor_temp >= MAX_CHARGE_TEMP_C);
-    datastore->ISL_BROWN_OUT = (!(ISL_GetSpecificBits_cached(ISL.USER_FLAG_0) && ISL_GetSpecificBits_cached(ISL.USER_FLAG_1) && ISL_GetSpecificBits_cached(ISL.WKPOL)));
-    
-    datastore->DETECT_MODE = (uint8_t)detect;
-
-    if (state == ERROR && 
-        (past_error_reason.ISL_INT_OVERTEMP_FLAG || 
-         past_error_reason.ISL_EXT_OVERTEMP_FLAG || 
-         past_error_reason.ISL_INT_OVERTEMP_PICREAD || 
-         past_error_reason.THERMISTOR_OVERTEMP_PICREAD || 
-         past_error_reason.CHARGE_ISL_INT_OVERTEMP_PICREAD || 
-         past_error_reason.CHARGE_THERMISTOR_OVERTEMP_PICREAD || 
-         past_error_reason.UNDERTEMP_FLAG)) {
-        datastore->TEMP_HYSTERESIS |= (isl_int_temp < MAX_DISCHARGE_TEMP_C && !(isl_int_temp + HYSTERESIS_TEMP_C < MAX_DISCHARGE_TEMP_C));
-        datastore->TEMP_HYSTERESIS |= (thermistor_temp < MAX_DISCHARGE_TEMP_C && !(thermistor_temp + HYSTERESIS_TEMP_C < MAX_DISCHARGE_TEMP_C));
-        
-        datastore->TEMP_HYSTERESIS |= (past_error_reason.DETECT_MODE == CHARGER && 
-                                       isl_int_temp < MAX_CHARGE_TEMP_C && 
-                                       !(isl_int_temp + HYSTERESIS_TEMP_C < MAX_CHARGE_TEMP_C));
-        datastore->TEMP_HYSTERESIS |= (past_error_reason.DETECT_MODE == CHARGER && 
-                                       thermistor_temp < MAX_CHARGE_TEMP_C && 
-                                       !(thermistor_temp + HYSTERESIS_TEMP_C < MAX_CHARGE_TEMP_C));
+    error_reason_t reasons = (error_reason_t)(detect & ERR_DETECT_MODE_MASK);
+
+    if (ISL_GetSpecificBits_cached(ISL.INT_OVER_TEMP_STATUS)) {
+        reasons |= ERR_ISL_INT_OVERTEMP_FLAG;
+    }
+    if (ISL_GetSpecificBits_cached(ISL.EXT_OVER_TEMP_STATUS)) {
+        reasons |= ERR_ISL_EXT_OVERTEMP_FLAG;
+    }
+    if (isl_int_temp >= MAX_DISCHARGE_TEMP_C) {
+        reasons |= ERR_ISL_INT_OVERTEMP_PICREAD;
+    }
+    if (thermistor_temp >= MAX_DISCHARGE_TEMP_C) {
+        reasons |= ERR_THERMISTOR_OVERTEMP_PICREAD;
+    }
+    if (isl_int_temp <= MIN_TEMP_C || thermistor_temp <= MIN_TEMP_C) {
+        reasons |= ERR_UNDERTEMP_FLAG;
+    }
+    if (ISL_GetSpecificBits_cached(ISL.OC_CHARGE_STATUS)) {
+        reasons |= ERR_CHARGE_OC_FLAG;
+    }
+    if (ISL_GetSpecificBits_cached(ISL.OC_DISCHARGE_STATUS)) {
+        reasons |= ERR_DISCHARGE_OC_FLAG;
+    }
+    if (ISL_GetSpecificBits_cached(ISL.SHORT_CIRCUIT_STATUS)) {
+        reasons |= ERR_DISCHARGE_SC_FLAG;
+    }
+    if (discharge_current_mA >= MAX_DISCHARGE_CURRENT_mA) {
+        reasons |= ERR_DISCHARGE_OC_SHUNT_PICREAD;
+    }
+#ifdef ENABLE_COMPARATOR_OC_TRIP
+    if (comparator_oc_tripped) {
+        reasons |= ERR_DISCHARGE_OC_SHUNT_PICREAD;
+    }
+#endif
+    if (!(ISL_GetSpecificBits_cached(ISL.USER_FLAG_0) && ISL_GetSpecificBits_cached(ISL.USER_FLAG_1) && ISL_GetSpecificBits_cached(ISL.WKPOL))) {
+        reasons |= ERR_ISL_BROWN_OUT;
+    }
+
+    if (state == CHARGING && isl_int_temp >= MAX_CHARGE_TEMP_C) {
+        reasons |= ERR_CHARGE_ISL_INT_OVERTEMP_PICREAD;
+    }
+    if (state == CHARGING && thermistor_temp >= MAX_CHARGE_TEMP_C) {
+        reasons |= ERR_CHARGE_THERMISTOR_OVERTEMP_PICREAD;
+    }
+
+    if (state == ERROR && (past_error_reason & ERR_TEMP_MASK)) {
+        if (ERR_DETECT_MODE(past_error_reason) == CHARGER && thermistor_temp >= MAX_CHARGE_TEMP_C) {
+            reasons |= ERR_CHARGE_THERMISTOR_OVERTEMP_PICREAD;
+        }
+        if (ERR_DETECT_MODE(past_error_reason) == CHARGER && isl_int_temp >= MAX_CHARGE_TEMP_C) {
+            reasons |= ERR_CHARGE_ISL_INT_OVERTEMP_PICREAD;
+        }
+
+        bool hysteresis = false;
+        hysteresis |= (isl_int_temp < MAX_DISCHARGE_TEMP_C && !(isl_int_temp + HYSTERESIS_TEMP_C < MAX_DISCHARGE_TEMP_C));
+        hysteresis |= (thermistor_temp < MAX_DISCHARGE_TEMP_C && !(thermistor_temp + HYSTERESIS_TEMP_C < MAX_DISCHARGE_TEMP_C));
         
-        datastore->CHARGE_THERMISTOR_OVERTEMP_PICREAD |= (past_error_reason.DETECT_MODE == CHARGER && 
-                                                         thermistor_temp >= MAX_CHARGE_TEMP_C);
-        datastore->CHARGE_ISL_INT_OVERTEMP_PICREAD |= (past_error_reason.DETECT_MODE == CHARGER && 
-                                                      isl_int_temp >= MAX_CHARGE_TEMP_C);
+        hysteresis |= (ERR_DETECT_MODE(past_error_reason) == CHARGER && 
+                       isl_int_temp < MAX_CHARGE_TEMP_C && 
+                       !(isl_int_temp + HYSTERESIS_TEMP_C < MAX_CHARGE_TEMP_C));
+        hysteresis |= (ERR_DETECT_MODE(past_error_reason) == CHARGER && 
+                       thermistor_temp < MAX_CHARGE_TEMP_C && 
+                       !(thermistor_temp + HYSTERESIS_TEMP_C < MAX_CHARGE_TEMP_C));
         
-        datastore->TEMP_HYSTERESIS |= (isl_int_temp > MIN_TEMP_C && !(isl_int_temp - HYSTERESIS_TEMP_C > MIN_TEMP_C));
-        datastore->TEMP_HYSTERESIS |= (thermistor_temp > MIN_TEMP_C && !(thermistor_temp - HYSTERESIS_TEMP_C > MIN_TEMP_C));
+        hysteresis |= (isl_int_temp > MIN_TEMP_C && !(isl_int_temp - HYSTERESIS_TEMP_C > MIN_TEMP_C));
+        hysteresis |= (thermistor_temp > MIN_TEMP_C && !(thermistor_temp - HYSTERESIS_TEMP_C > MIN_TEMP_C));
+        if (hysteresis) {
+            reasons |= ERR_TEMP_HYSTERESIS;
+        }
+    }
+
+    *datastore = (*datastore & ERR_CRITICAL_I2C) | reasons;    // ERR_CRITICAL_I2C is owned by the error state, keep it
+}
+
+/* LED codes shown in the error state, highest priority first. The first row whose mask
+ * overlaps the latched reasons is shown. Every code blinks 500ms on / 500ms off.
+ */
+static const fault_led_code_t fault_led_codes[] = {
+    {ERR_ISL_BROWN_OUT,                 16, 0b100, 1000},
+    {ERR_CRITICAL_I2C,                  15, 0b100, 1000},
+    {ERR_ISL_INT_OVERTEMP_FLAG | ERR_ISL_INT_OVERTEMP_PICREAD | ERR_THERMISTOR_OVERTEMP_PICREAD
+        | ERR_CHARGE_ISL_INT_OVERTEMP_PICREAD | ERR_CHARGE_THERMISTOR_OVERTEMP_PICREAD,
+                                        0,  0b110, 0},
+    {ERR_ISL_EXT_OVERTEMP_FLAG,         5,  0b100, 1000},
+    {ERR_CHARGE_OC_FLAG,                8,  0b100, 1000},
+    {ERR_DISCHARGE_OC_FLAG,             9,  0b100, 1000},
+    {ERR_DISCHARGE_SC_FLAG,             10, 0b100, 1000},
+    {ERR_DISCHARGE_OC_SHUNT_PICREAD,    11, 0b100, 1000},
+    {ERR_UNDERTEMP_FLAG,                14, 0b100, 1000},
+};
+
+#define NUM_OF_FAULT_LED_CODES (sizeof(fault_led_codes) / sizeof(fault_led_codes[0]))
+
+bool faultLEDCode(error_reason_t reasons) {
+    for (uint8_t i = 0; i < NUM_OF_FAULT_LED_CODES; i++) {
+        const fault_led_code_t *code = &fault_led_codes[i];
+        if (reasons & code->mask) {
+            ledBlinkpattern(code->num_blinks, code->led_color_rgb, 500, 500, code->blank_time_ms, code->blank_time_ms, 0);
+            return true;
+        }
     }
-}
\ No newline at end of file
+    return false;
+}
+
+#ifdef ENABLE_COMPARATOR_OC_TRIP
+volatile bool comparator_oc_tripped = false;
+
+void comparatorOCInit(void) {
+    // DAC from the 1.024V FVR. Round the threshold up to the next 32mV step so we never trip below the limit.
+    FVRCONbits.CDAFVR = 0b01;
+    FVRCONbits.FVREN = 1;
+    while (!FVRCONbits.FVRRDY);
+    DACCON0bits.DACPSS = 0b10;
+    DACCON0bits.DACNSS = 0;
+    DACCON0bits.DACEN = 1;
+    uint16_t threshold_mV = MAX_DISCHARGE_CURRENT_mA / DISCHARGE_ISENSE_mA_PER_mV;
+    DAC_SetOutput((uint8_t) ((threshold_mV * 32 + COMPARATOR_DAC_FVR_mV - 1) / COMPARATOR_DAC_FVR_mV));
+
+    // C1: shunt on C12IN0- (RA0) against the DAC on C1IN+. Inverted so the output goes high on overcurrent.
+    CM1CON1bits.C1PCH = 0b01;
+    CM1CON1bits.C1NCH = 0b00;
+    CM1CON1bits.C1INTP = 1;
+    CM1CON1bits.C1INTN = 0;
+    CM1CON0bits.C1POL = 1;
+    CM1CON0bits.C1SP = 1;       // High speed
+    CM1CON0bits.C1HYS = 1;
+    CM1CON0bits.C1SYNC = 0;     // Asynchronous output, no waiting on a timer edge
+    CM1CON0bits.C1OE = 0;
+    CM1CON0bits.C1ON = 1;
+
+    PIR2bits.C1IF = 0;
+    PIE2bits.C1IE = 1;
+    INTCONbits.PEIE = 1;
+    INTCONbits.GIE = 1;
+}
+
+void comparatorOCInterrupt(void) {
+    PIR2bits.C1IF = 0;
+    ISL_DischargeCutoffFromISR();
+    comparator_oc_tripped = true;
+}
+
+void comparatorOCRearm(void) {  //Called once the trip has been latched into past_error_reason
+    comparator_oc_tripped = false;
+}
+#endif
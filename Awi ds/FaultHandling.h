@@ -28,10 +28,60 @@ Contact: 112460193@qq.com | www.awi.design
 #include "main.h"
 #include "config.h"
 
-bool safetyChecks(void);
+// Packed fault word, one bit per limit checked by evaluateSafety()
+#define FAULT_ISL_SHORT_CIRCUIT             (1u << 0)   // ISL short circuit status flag. Never debounced.
+#define FAULT_ISL_STATUS                    (1u << 1)   // Any other ISL status flag set
+#define FAULT_DISCHARGE_OC_SHUNT            (1u << 2)   // PIC shunt reading at or above MAX_DISCHARGE_CURRENT_mA
+#define FAULT_ISL_INT_OVERTEMP              (1u << 3)   // ISL internal temp at or above MAX_DISCHARGE_TEMP_C
+#define FAULT_THERMISTOR_OVERTEMP           (1u << 4)   // Thermistor at or above MAX_DISCHARGE_TEMP_C
+#define FAULT_UNDERTEMP                     (1u << 5)   // Either sensor at or below MIN_TEMP_C
+#define FAULT_ISL_INT_CHARGE_OVERTEMP       (1u << 6)   // ISL internal temp at or above MAX_CHARGE_TEMP_C
+#define FAULT_THERMISTOR_CHARGE_OVERTEMP    (1u << 7)   // Thermistor at or above MAX_CHARGE_TEMP_C
+
+#define FAULT_TEMP_MASK         (FAULT_ISL_INT_OVERTEMP | FAULT_THERMISTOR_OVERTEMP | FAULT_UNDERTEMP)
+#define FAULT_DISCHARGE_MASK    (FAULT_ISL_SHORT_CIRCUIT | FAULT_ISL_STATUS | FAULT_DISCHARGE_OC_SHUNT | FAULT_TEMP_MASK)
+#define FAULT_CHARGE_MASK       (FAULT_DISCHARGE_MASK | FAULT_ISL_INT_CHARGE_OVERTEMP | FAULT_THERMISTOR_CHARGE_OVERTEMP)
+
+typedef struct {
+    uint8_t raw_faults; // FAULT_* bits seen in the latest acquisition
+    uint8_t faults;     // FAULT_* bits that passed their debounce filter
+    bool discharge_ok;  // No FAULT_DISCHARGE_MASK bits set
+    bool charge_ok;     // No FAULT_CHARGE_MASK bits set
+    bool temp_ok;       // No FAULT_TEMP_MASK bits set
+} safety_status_t;
+
+extern safety_status_t safety;
+
+typedef struct {
+    uint8_t fault;          // FAULT_* bit
+    uint8_t required;       // Ticks with the fault present needed to act on it
+    uint8_t window;         // Number of most recent ticks looked at, 1 to 8
+} fault_filter_t;
+
+typedef struct {
+    error_reason_t mask;        // ERR_* bits that select this code
+    uint8_t num_blinks;
+    uint8_t led_color_rgb;
+    uint16_t blank_time_ms;     // Blank time before and after the blinks
+} fault_led_code_t;
+
+void evaluateSafety(bool new_sample);
+extern uint8_t cell_ir_mOhm;
+
 bool minCellOK(void);
+uint16_t minCellCutoff_mV(void);
+void updateCellResistance(bool scan_complete);
 bool maxCellOK(void);
-bool chargeTempCheck(void);
 void setErrorReasonFlags(volatile error_reason_t *datastore);
+bool faultLEDCode(error_reason_t reasons);
+#ifdef ENABLE_COMPARATOR_OC_TRIP
+extern volatile bool comparator_oc_tripped;
+void comparatorOCInit(void);
+void comparatorOCInterrupt(void);
+void comparatorOCRearm(void);
+#endif
+void updateDischargeReadyFlag(void);
+bool dischargeReady(void);
+bool faultsPending(void);
 
 #endif /* FAULT_HANDLING_H */
\ No newline at end of file
@@ -0,0 +1,144 @@
+/*
+
+AWI-Dyson-BMS - Dyson Battery Management System Configuration
+Copyright (C) 2025 AWi
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program. If not, see https://www.gnu.org/licenses/.
+Note: As an addendum to the GNU General Public License, any hardware
+using this project’s code or information must publicly disclose
+complete electrical schematics and a bill of materials for such hardware.
+Acknowledgements:
+Thanks to tinfever, the author of version 1, for compiling
+and open-sourcing it.
+Thanks to Dr. Mark Roberts for his contributions to the V8 open-source code.
+Contact: 112460193@qq.com | www.awi.design
+(Website is currently under maintenance) */
+
+#include "Histograms.h"
+#include "EEPROMLog.h"
+#include "isl94208.h"
+
+#ifdef ENABLE_USAGE_HISTOGRAMS
+
+/* Lifetime usage counters. Time is gathered per bin in RAM on every tick advance and added to the EEPROM counters by
+ * Histograms_Flush() every HISTOGRAM_FLUSH_TICKS, at the end of each discharge and charge, and before SLEEP. Only the
+ * bytes that changed are queued, so a flush usually costs a few byte writes. Partial units stay in RAM.
+ */
+
+static uint16_t pending_temp_ticks[HIST_TEMP_BINS];
+static uint16_t pending_current_ticks[HIST_CURRENT_BINS];
+static uint16_t pending_state_ticks[HIST_STATE_BINS];
+static uint32_t pending_mA_ticks = 0;
+static uint32_t pending_mW_ticks = 0;
+static uint8_t pending_deci_Ah = 0;
+static uint8_t pending_Wh = 0;
+static uint8_t pending_dod_bin = HIST_DOD_BINS;     // HIST_DOD_BINS when no discharge ended since the last flush
+static bool pending_cycle = false;
+static uint16_t discharge_min_cell_mV = 0xFFFF;
+static uint16_t flush_countdown = HISTOGRAM_FLUSH_TICKS;
+
+static void _AddToCounter(uint8_t offset, uint16_t amount) {
+    if (amount == 0) {
+        return;
+    }
+    uint8_t addr = EEPROM_HISTOGRAM_ADDR + offset;
+    uint16_t value = (uint16_t)EEPROMLog_ReadByte(addr) << 8 | EEPROMLog_ReadByte(addr + 1);
+    value = (value > 0xFFFF - amount) ? 0xFFFF : value + amount;
+    EEPROMLog_WriteByte(addr, (uint8_t)(value >> 8));
+    EEPROMLog_WriteByte(addr + 1, (uint8_t)value);
+}
+
+static uint16_t _TakeUnits(uint16_t *pending_ticks, uint16_t unit_ticks) {
+    uint16_t units = *pending_ticks / unit_ticks;
+    *pending_ticks -= units * unit_ticks;
+    return units;
+}
+
+void Histograms_Tick(uint8_t ticks) {
+    if (state >= HIST_STATE_FIRST && state < HIST_STATE_FIRST + HIST_STATE_BINS) {
+        pending_state_ticks[state - HIST_STATE_FIRST] += ticks;
+    }
+
+    int16_t temp = (isl_int_temp > thermistor_temp) ? isl_int_temp : thermistor_temp;
+    uint8_t bin = (temp < 0) ? 0 : (temp < 20) ? 1 : (temp < 35) ? 2 : (temp < 50) ? 3 : 4;
+    pending_temp_ticks[bin] += ticks;
+
+    if (state == OUTPUT_EN) {
+        bin = (discharge_current_mA < 5000) ? 0 : (discharge_current_mA < 10000) ? 1 : (discharge_current_mA < 20000) ? 2 : 3;
+        pending_current_ticks[bin] += ticks;
+
+        pending_mA_ticks += (uint32_t)discharge_current_mA * ticks;
+        if (pending_mA_ticks >= HIST_DECI_AH_mA_TICKS) {
+            pending_mA_ticks -= HIST_DECI_AH_mA_TICKS;
+            pending_deci_Ah++;
+        }
+        pending_mW_ticks += (uint32_t)discharge_current_mA * cellstats.pack_mV / 1000 * ticks;
+        if (pending_mW_ticks >= HIST_WH_mW_TICKS) {
+            pending_mW_ticks -= HIST_WH_mW_TICKS;
+            pending_Wh++;
+        }
+        if (cellstats.mincell_mV != 0 && cellstats.mincell_mV < discharge_min_cell_mV) {
+            discharge_min_cell_mV = cellstats.mincell_mV;
+        }
+    }
+
+    if (flush_countdown > ticks) {
+        flush_countdown -= ticks;
+    } else {
+        Histograms_Flush();
+    }
+}
+
+void Histograms_EndDischarge(void) {
+    if (discharge_min_cell_mV != 0xFFFF) {
+        pending_dod_bin = (discharge_min_cell_mV >= 3600) ? 0 : (discharge_min_cell_mV >= 3300) ? 1 : 2;
+        discharge_min_cell_mV = 0xFFFF;
+    }
+    Histograms_Flush();
+}
+
+void Histograms_ChargeComplete(void) {
+    pending_cycle = true;
+    Histograms_Flush();
+}
+
+void Histograms_Flush(void) {
+    flush_countdown = HISTOGRAM_FLUSH_TICKS;
+    for (uint8_t i = 0; i < HIST_TEMP_BINS; i++) {
+        _AddToCounter(HIST_TEMP_OFFSET + 2 * i, _TakeUnits(&pending_temp_ticks[i], HIST_MINUTE_TICKS));
+    }
+    for (uint8_t i = 0; i < HIST_CURRENT_BINS; i++) {
+        _AddToCounter(HIST_CURRENT_OFFSET + 2 * i, _TakeUnits(&pending_current_ticks[i], HIST_CURRENT_UNIT_TICKS));
+    }
+    for (uint8_t i = 0; i < HIST_STATE_BINS; i++) {
+        _AddToCounter(HIST_STATE_OFFSET + 2 * i, _TakeUnits(&pending_state_ticks[i], HIST_MINUTE_TICKS));
+    }
+    if (pending_dod_bin < HIST_DOD_BINS) {
+        _AddToCounter(HIST_DOD_OFFSET + 2 * pending_dod_bin, 1);
+        pending_dod_bin = HIST_DOD_BINS;
+    }
+    if (pending_cycle) {
+        _AddToCounter(HIST_CYCLES_OFFSET, 1);
+        pending_cycle = false;
+    }
+    _AddToCounter(HIST_AH_OFFSET, pending_deci_Ah);
+    _AddToCounter(HIST_WH_OFFSET, pending_Wh);
+    pending_deci_Ah = 0;
+    pending_Wh = 0;
+}
+
+void Histograms_Format(void) {
+    for (uint8_t i = 0; i < HIST_SIZE; i++) {
+        EEPROMLog_WriteByte(EEPROM_HISTOGRAM_ADDR + i, 0);
+    }
+}
+
+#endif
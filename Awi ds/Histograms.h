@@ -0,0 +1,57 @@
+/*
+
+AWI-Dyson-BMS - Dyson Battery Management System Configuration
+Copyright (C) 2025 AWi
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program. If not, see https://www.gnu.org/licenses/.
+Note: As an addendum to the GNU General Public License, any hardware
+using this project’s code or information must publicly disclose
+complete electrical schematics and a bill of materials for such hardware.
+Acknowledgements:
+Thanks to tinfever, the author of version 1, for compiling
+and open-sourcing it.
+Thanks to Dr. Mark Roberts for his contributions to the V8 open-source code.
+Contact: 112460193@qq.com | www.awi.design
+(Website is currently under maintenance) */
+
+#ifndef HISTOGRAMS_H
+#define HISTOGRAMS_H
+
+#include "main.h"
+#include "config.h"
+
+// EEPROM layout from EEPROM_HISTOGRAM_ADDR, 16-bit counters MSB first, saturating
+#define HIST_TEMP_BINS 5            // Hotter of the two temperatures: <0, <20, <35, <50, >=50C. Minutes awake.
+#define HIST_CURRENT_BINS 4         // Discharge current: <5, <10, <20, >=20A. HIST_CURRENT_UNIT_TICKS units in OUTPUT_EN.
+#define HIST_DOD_BINS 3             // Lowest loaded min cell per discharge: >=3600, >=3300, <3300mV. Discharges.
+#define HIST_STATE_FIRST IDLE       // Minutes in each state from IDLE to ERROR. INIT and SLEEP only last a pass and
+#define HIST_STATE_BINS (ERROR - IDLE + 1)  // CRITICAL_ERROR waits for a RESET, so they aren't counted.
+#define HIST_TEMP_OFFSET 0
+#define HIST_CURRENT_OFFSET (HIST_TEMP_OFFSET + 2 * HIST_TEMP_BINS)
+#define HIST_STATE_OFFSET (HIST_CURRENT_OFFSET + 2 * HIST_CURRENT_BINS)
+#define HIST_DOD_OFFSET (HIST_STATE_OFFSET + 2 * HIST_STATE_BINS)
+#define HIST_CYCLES_OFFSET (HIST_DOD_OFFSET + 2 * HIST_DOD_BINS)           // Completed charges
+#define HIST_AH_OFFSET (HIST_CYCLES_OFFSET + 2)                            // Discharged, 0.1Ah
+#define HIST_WH_OFFSET (HIST_AH_OFFSET + 2)                                // Discharged, Wh
+#define HIST_SIZE (HIST_WH_OFFSET + 2)
+
+#define HIST_MINUTE_TICKS 1875
+#define HIST_CURRENT_UNIT_TICKS 250     // 8 seconds
+#define HIST_DECI_AH_mA_TICKS 11250000u     // 360 As in mA x 32ms ticks
+#define HIST_WH_mW_TICKS 112500000u         // 3600 Ws in mW x 32ms ticks
+
+void Histograms_Tick(uint8_t ticks);
+void Histograms_EndDischarge(void);
+void Histograms_ChargeComplete(void);
+void Histograms_Flush(void);
+void Histograms_Format(void);
+
+#endif /* HISTOGRAMS_H */
@@ -4,6 +4,8 @@
 #include "config.h"
 #include "isl94208.h"
 
+static uint8_t fade_ticks = 0; // Ticks elapsed since the PWM fade last stepped
+
 void ledBlinkpattern(uint8_t num_blinks, uint8_t led_color_rgb, uint16_t blink_on_time_ms, uint16_t blink_off_time_ms, uint16_t starting_blank_time_ms, uint16_t ending_blank_time_ms, int8_t pwm_fade_slope) {
     uint16_t timer_ms = nonblocking_wait_counter.value * 32;
     static uint8_t max_steps = 0;
@@ -19,6 +21,7 @@ void ledBlinkpattern(uint8_t num_blinks, uint8_t led_color_rgb, uint16_t blink_o
         max_steps = (num_blinks == 0) ? 1 : (2 * num_blinks + 2) - 1;
         step = 0;
         next_step_time = starting_blank_time_ms;
+        fade_ticks = 0;
         if (LED_code_cycle_counter.enable) {
             LED_code_cycle_counter.value++;
         }
@@ -48,10 +51,14 @@ void ledBlinkpattern(uint8_t num_blinks, uint8_t led_color_rgb, uint16_t blink_o
         next_step_time += blink_on_time_ms;
     }
 
+    // pwm_fade_slope is in duty steps per 32 ms tick, so the fade keeps its
+    // speed however often the main loop passes through here.
     int16_t current_pwm = (int16_t)EPWM1_ReadDutyValue();
+    int16_t fade_step = (int16_t)pwm_fade_slope * fade_ticks;
+    fade_ticks = 0;
     if (pwm_fade_slope < 0) {
-        if (current_pwm > -pwm_fade_slope) {
-            EPWM1_LoadDutyValue((uint16_t)(current_pwm + pwm_fade_slope));
+        if (current_pwm > -fade_step) {
+            EPWM1_LoadDutyValue((uint16_t)(current_pwm + fade_step));
         } else {
             EPWM1_LoadDutyValue(0);
             nonblocking_wait_counter.value = next_step_time / 32;
@@ -64,8 +71,8 @@ void ledBlinkpattern(uint8_t num_blinks, uint8_t led_color_rgb, uint16_t blink_o
             }
         }
     } else if (pwm_fade_slope > 0) {
-        if (current_pwm + pwm_fade_slope < 1023) {
-            EPWM1_LoadDutyValue((uint16_t)(current_pwm + pwm_fade_slope));
+        if (current_pwm + fade_step < 1023) {
+            EPWM1_LoadDutyValue((uint16_t)(current_pwm + fade_step));
         } else {
             EPWM1_LoadDutyValue(1023);
             nonblocking_wait_counter.value = (next_step_time / 32) + 1;
@@ -94,6 +101,10 @@ void ledBlinkpattern(uint8_t num_blinks, uint8_t led_color_rgb, uint16_t blink_o
     }
 }
 
+void ledAdvanceFade(uint8_t ticks) {
+    fade_ticks = (fade_ticks > 0xFF - ticks) ? 0xFF : (uint8_t)(fade_ticks + ticks);
+}
+
 void resetLEDBlinkPattern(void) {
     Set_LED_RGB(0b000, 1023);
     nonblocking_wait_counter.enable = false;
@@ -138,7 +149,12 @@ void ledBreathe(uint8_t led_color_rgb, uint8_t num_breaths, uint16_t breath_inte
 }
 
 bool cellDeltaLEDIndicator(void) {
-    uint8_t num_yellow_blinks = (uint8_t)((cellstats.packdelta_mV + 25) / 50);
+    static uint8_t num_yellow_blinks = 0;
+    static uint8_t num_yellow_blinks_revision = 0xFF;
+    if (num_yellow_blinks_revision != cellstats.revision) {     // Only recalculated when a cell reading changed
+        num_yellow_blinks_revision = cellstats.revision;
+        num_yellow_blinks = (uint8_t)((cellstats.packdelta_mV + 25) / 50);
+    }
     LED_code_cycle_counter.enable = true;
     ledBlinkpattern(num_yellow_blinks, 0b110, 250, 250, 750, 500, 0);
     if (LED_code_cycle_counter.value > 1) {
@@ -29,6 +29,7 @@ Contact: 112460193@qq.com | www.awi.design
 #include <stdbool.h>
 
 void ledBlinkpattern(uint8_t num_blinks, uint8_t led_color_rgb, uint16_t blink_on_time_ms, uint16_t blink_off_time_ms, uint16_t starting_blank_time_ms, uint16_t ending_blank_time_ms, int8_t pwm_fade_slope);
+void ledAdvanceFade(uint8_t ticks);
 void resetLEDBlinkPattern(void);
 void Set_LED_RGB(uint8_t RGB_en, uint16_t PWM_val);
 bool cellDeltaLEDIndicator(void);
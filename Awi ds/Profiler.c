@@ -0,0 +1,126 @@
+/*
+
+AWI-Dyson-BMS - Dyson Battery Management System Configuration
+Copyright (C) 2025 AWi
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program. If not, see https://www.gnu.org/licenses/.
+Note: As an addendum to the GNU General Public License, any hardware
+using this project’s code or information must publicly disclose
+complete electrical schematics and a bill of materials for such hardware.
+Acknowledgements:
+Thanks to tinfever, the author of version 1, for compiling
+and open-sourcing it.
+Thanks to Dr. Mark Roberts for his contributions to the V8 open-source code.
+Contact: 112460193@qq.com | www.awi.design
+(Website is currently under maintenance) */
+
+#include "Profiler.h"
+#include "mcc_generated_files/mcc.h"
+
+#ifdef ENABLE_LOOP_PROFILER
+
+/* TMR1 free-runs from Fosc/4 with a 1:8 prescaler, giving 1us per count at 32MHz. It wraps every 65.5ms, and its
+ * overflow interrupt counts the wraps into the upper 16 bits of the time, so slow passes through EEPROM
+ * flushes or I2C retries are measured in full. TMR1 stops during SLEEP, so the loop times exclude time spent in
+ * lowPowerWait().
+ */
+
+profile_stats_t phase_profile[NUM_OF_PHASES];
+profile_stats_t state_loop_profile[NUM_OF_STATES];
+
+static volatile uint16_t timer_overflows = 0;
+static uint32_t loop_start_time;
+static uint32_t phase_start_time[NUM_OF_PHASES];
+static uint32_t phase_elapsed_us[NUM_OF_PHASES];
+static uint8_t phase_ran_mask;
+
+static uint32_t _Now(void) {
+    uint16_t overflows;
+    uint8_t high;
+    uint8_t low;
+    do {
+        overflows = timer_overflows;
+        high = TMR1H;
+        low = TMR1L;
+    } while (high != TMR1H || overflows != timer_overflows);    //Re-read if the low byte or the ISR moved on between reads
+    if (PIR1bits.TMR1IF && high < 0x80) {
+        overflows++;    //Wrapped while interrupts were held off, the ISR hasn't counted it yet
+    }
+    return (uint32_t)overflows << 16 | (uint16_t)high << 8 | low;
+}
+
+void Profiler_TimerOverflow(void) {
+    PIR1bits.TMR1IF = 0;
+    timer_overflows++;
+}
+
+static void _AddSample(profile_stats_t *stats, uint32_t sample_us) {
+    if (stats->count == 0) {
+        stats->min_us = sample_us;
+        stats->max_us = sample_us;
+        stats->mean_us = sample_us;
+    } else {
+        if (sample_us < stats->min_us) {
+            stats->min_us = sample_us;
+        }
+        if (sample_us > stats->max_us) {
+            stats->max_us = sample_us;
+        }
+        stats->mean_us = (uint32_t) ((int32_t)stats->mean_us + ((int32_t)sample_us - (int32_t)stats->mean_us) / 8);
+    }
+    if (stats->count < 0xFFFF) {
+        stats->count++;
+    }
+}
+
+void Profiler_Init(void) {
+    T1CONbits.TMR1ON = 0;
+    T1CONbits.TMR1CS = 0b00;    //Fosc/4
+    T1CONbits.T1CKPS = 0b11;    //1:8
+    TMR1H = 0;
+    TMR1L = 0;
+    PIR1bits.TMR1IF = 0;
+    PIE1bits.TMR1IE = 1;
+    INTCONbits.PEIE = 1;
+    INTCONbits.GIE = 1;
+    T1CONbits.TMR1ON = 1;
+}
+
+void Profiler_LoopStart(void) {
+    loop_start_time = _Now();
+    phase_ran_mask = 0;
+}
+
+void Profiler_LoopEnd(state_t loop_state) {
+    uint32_t loop_time_us = _Now() - loop_start_time;
+    for (uint8_t phase = 0; phase < NUM_OF_PHASES; phase++) {
+        if (phase_ran_mask & (1 << phase)) {
+            _AddSample(&phase_profile[phase], phase_elapsed_us[phase]);
+        }
+    }
+    if (loop_state < NUM_OF_STATES) {
+        _AddSample(&state_loop_profile[loop_state], loop_time_us);
+    }
+}
+
+void Profiler_Start(profile_phase_t phase) {
+    if (!(phase_ran_mask & (1 << phase))) {
+        phase_elapsed_us[phase] = 0;    //First time this phase runs in this pass
+        phase_ran_mask |= (uint8_t) (1 << phase);
+    }
+    phase_start_time[phase] = _Now();
+}
+
+void Profiler_Stop(profile_phase_t phase) {
+    phase_elapsed_us[phase] += _Now() - phase_start_time[phase];    //Phases that run in several pieces per pass are summed into one sample
+}
+
+#endif
@@ -0,0 +1,66 @@
+/*
+
+AWI-Dyson-BMS - Dyson Battery Management System Configuration
+Copyright (C) 2025 AWi
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program. If not, see https://www.gnu.org/licenses/.
+Note: As an addendum to the GNU General Public License, any hardware
+using this project’s code or information must publicly disclose
+complete electrical schematics and a bill of materials for such hardware.
+Acknowledgements:
+Thanks to tinfever, the author of version 1, for compiling
+and open-sourcing it.
+Thanks to Dr. Mark Roberts for his contributions to the V8 open-source code.
+Contact: 112460193@qq.com | www.awi.design
+(Website is currently under maintenance) */
+
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include "main.h"
+#include "config.h"
+
+typedef enum {
+    PHASE_ISL_REGISTERS = 0,    // ISL register reads and discharge current
+    PHASE_CELL_SCAN,            // ISL_ReadAllCellVoltages, including the cell statistics
+    PHASE_TEMPERATURE,          // ISL internal temp and thermistor
+    PHASE_DETECT,               // checkDetect
+    PHASE_STATE_HANDLER,        // State machine handler for the current state
+    PHASE_EEPROM,               // EEPROM writes, also counted inside PHASE_STATE_HANDLER
+    NUM_OF_PHASES,
+} profile_phase_t;
+
+typedef struct {
+    uint32_t min_us;
+    uint32_t max_us;
+    uint32_t mean_us;   // Moving average with a weight of 1/8 per sample
+    uint16_t count;     // Saturates at 0xFFFF
+} profile_stats_t;
+
+#ifdef ENABLE_LOOP_PROFILER
+extern profile_stats_t phase_profile[NUM_OF_PHASES];
+extern profile_stats_t state_loop_profile[NUM_OF_STATES];
+
+void Profiler_Init(void);
+void Profiler_TimerOverflow(void);
+void Profiler_LoopStart(void);
+void Profiler_LoopEnd(state_t loop_state);
+void Profiler_Start(profile_phase_t phase);
+void Profiler_Stop(profile_phase_t phase);
+
+#define PROFILE_START(phase) Profiler_Start(phase)
+#define PROFILE_STOP(phase) Profiler_Stop(phase)
+#else
+#define PROFILE_START(phase)
+#define PROFILE_STOP(phase)
+#endif
+
+#endif /* PROFILER_H */
@@ -0,0 +1,189 @@
+/*
+
+AWI-Dyson-BMS - Dyson Battery Management System Configuration
+Copyright (C) 2025 AWi
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program. If not, see https://www.gnu.org/licenses/.
+Note: As an addendum to the GNU General Public License, any hardware
+using this project’s code or information must publicly disclose
+complete electrical schematics and a bill of materials for such hardware.
+Acknowledgements:
+Thanks to tinfever, the author of version 1, for compiling
+and open-sourcing it.
+Thanks to Dr. Mark Roberts for his contributions to the V8 open-source code.
+Contact: 112460193@qq.com | www.awi.design
+(Website is currently under maintenance) */
+
+#include <stddef.h>
+#include "StateMachine.h"
+#include "FaultHandling.h"
+#include "isl94208.h"
+#include "CellBalance.h"
+
+condition_t state_conditions = 0;
+transition_trace_t transition_trace[TRANSITION_TRACE_LENGTH];
+uint8_t transition_trace_index = 0;     //Next slot to be written, the oldest entry once the buffer has wrapped
+
+static condition_t pending_events = 0;
+
+static const state_actions_t state_table[NUM_OF_STATES] = {
+    [INIT] =            {NULL,              init,           NULL},
+    [SLEEP] =           {NULL,              sleep,          NULL},
+    [IDLE] =            {NULL,              idle,           idleExit},
+    [CHARGING] =        {NULL,              charging,       chargingExit},
+    [CHARGING_WAIT] =   {chargingWaitEntry, chargingWait,   chargingWaitExit},
+    [CELL_BALANCE] =    {cellBalanceEntry,  cellBalance,    cellBalanceExit},
+    [OUTPUT_EN] =       {outputENEntry,     outputEN,       outputENExit},
+    [ERROR] =           {errorEntry,        error,          errorExit},
+    [CRITICAL_ERROR] =  {criticalErrorEntry, criticalError, NULL},
+};
+
+/* Rows are checked in order and the first row for the current state that matches wins.
+ * A pass with no matching row runs the state action instead.
+ */
+static const transition_t transition_table[] = {
+    {IDLE,          COND_TRIGGER | COND_MIN_CELL_OK | COND_WKUP | COND_FULL_DISCHARGE | COND_SAFETY_OK,
+                    COND_TRIGGER | COND_MIN_CELL_OK | COND_WKUP | COND_SAFETY_OK,                   OUTPUT_EN,      NULL},
+    {IDLE,          COND_TRIGGER | COND_FULL_DISCHARGE, COND_TRIGGER | COND_FULL_DISCHARGE,         ERROR,          NULL},
+    {IDLE,          COND_CHARGER | COND_MAX_CELL_OK | COND_WKUP | COND_SAFETY_OK | COND_ACTION_DONE,
+                    COND_CHARGER | COND_MAX_CELL_OK | COND_WKUP | COND_SAFETY_OK | COND_ACTION_DONE, CHARGING,      NULL},
+    {IDLE,          COND_SAFETY_OK,         0,                                                      ERROR,          NULL},
+    {IDLE,          COND_BALANCE_WANTED,    COND_BALANCE_WANTED,                                    CELL_BALANCE,   NULL},
+    {IDLE,          COND_SLEEP_TIMEOUT,     COND_SLEEP_TIMEOUT,                                     SLEEP,          NULL},
+
+    {CHARGING,      COND_MAX_CELL_OK | COND_SHORT_CHARGE, COND_SHORT_CHARGE,                        IDLE,           markChargeComplete},
+    {CHARGING,      COND_MAX_CELL_OK,       0,                                                      CHARGING_WAIT,  NULL},
+    {CHARGING,      COND_SAFETY_OK,         0,                                                      ERROR,          NULL},
+    {CHARGING,      COND_CHARGE_TEMP_OK,    0,                                                      ERROR,          NULL},
+    {CHARGING,      COND_CHARGER,           0,                                                      IDLE,           NULL},
+    {CHARGING,      COND_WKUP,              0,                                                      IDLE,           NULL},
+
+    {CHARGING_WAIT, COND_SAFETY_OK,         0,                                                      ERROR,          NULL},
+    {CHARGING_WAIT, COND_CHARGER,           0,                                                      IDLE,           NULL},
+    {CHARGING_WAIT, COND_ACTION_DONE,       COND_ACTION_DONE,                                       IDLE,           markChargeComplete},
+    {CHARGING_WAIT, COND_BALANCE_WANTED,    COND_BALANCE_WANTED,                                    CELL_BALANCE,   NULL},
+    {CHARGING_WAIT, COND_CHARGE_WAIT_DONE,  COND_CHARGE_WAIT_DONE,                                  CHARGING,       NULL},
+
+    {CELL_BALANCE,  COND_SAFETY_OK,         0,                                                      ERROR,          NULL},
+    {CELL_BALANCE,  COND_CHARGER,           0,                                                      IDLE,           NULL},
+    {CELL_BALANCE,  COND_ACTION_DONE,       COND_ACTION_DONE,                                       IDLE,           NULL},
+
+    {OUTPUT_EN,     COND_MIN_CELL_OK,       0,                                                      IDLE,           markFullDischarge},
+    {OUTPUT_EN,     COND_SAFETY_OK,         0,                                                      ERROR,          NULL},
+    {OUTPUT_EN,     COND_ACTION_DONE,       COND_ACTION_DONE,                                       IDLE,           NULL},
+
+    {ERROR,         COND_CRITICAL_FAULT,    COND_CRITICAL_FAULT,                                    CRITICAL_ERROR, NULL},
+    {ERROR,         COND_ACTION_DONE,       COND_ACTION_DONE,                                       IDLE,           clearErrors},
+    {ERROR,         COND_SLEEP_TIMEOUT | COND_LED_IDLE | COND_CHARGER, COND_SLEEP_TIMEOUT | COND_LED_IDLE, SLEEP,  clearErrors},
+
+    {SLEEP,         COND_ACTION_DONE,       COND_ACTION_DONE,                                       IDLE,           NULL},
+};
+
+#define NUM_OF_TRANSITIONS (sizeof(transition_table) / sizeof(transition_table[0]))
+
+static condition_t _EvaluateConditions(void) {
+    condition_t conditions = 0;
+
+    if (detect == TRIGGER) {
+        conditions |= COND_TRIGGER;
+    } else if (detect == CHARGER) {
+        conditions |= COND_CHARGER;
+    }
+    if (ISL_GetSpecificBits_cached(ISL.WKUP_STATUS)) {
+        conditions |= COND_WKUP;
+    }
+    if (safety.discharge_ok) {
+        conditions |= COND_SAFETY_OK;
+    }
+    if (minCellOK()) {
+        conditions |= COND_MIN_CELL_OK;
+    }
+    if (maxCellOK()) {
+        conditions |= COND_MAX_CELL_OK;
+    }
+    if (safety.charge_ok) {
+        conditions |= COND_CHARGE_TEMP_OK;
+    }
+    if (full_discharge_flag) {
+        conditions |= COND_FULL_DISCHARGE;
+    }
+    if (ISL_GetSpecificBits_cached(ISL.ENABLE_DISCHARGE_FET)) {
+        conditions |= COND_DISCHARGE_FET;
+    }
+    if (cellBalanceWanted()) {
+        conditions |= COND_BALANCE_WANTED;
+    }
+    uint16_t sleep_timeout = (state == ERROR) ? ERROR_SLEEP_TIMEOUT : IDLE_SLEEP_TIMEOUT;
+    if (sleep_timeout_counter.enable && sleep_timeout_counter.value > sleep_timeout) {
+        conditions |= COND_SLEEP_TIMEOUT;
+    }
+    if (!nonblocking_wait_counter.enable && nonblocking_wait_counter.value == 0) {
+        conditions |= COND_LED_IDLE;
+    }
+    if (charge_wait_counter.enable && charge_wait_counter.value >= CHARGE_WAIT_TIMEOUT) {
+        conditions |= COND_CHARGE_WAIT_DONE;
+    }
+    if (charge_duration_counter.value < CHARGE_COMPELTE_TIMEOUT) {
+        conditions |= COND_SHORT_CHARGE;
+    }
+    if (past_error_reason & (ERR_CRITICAL_I2C | ERR_ISL_BROWN_OUT)) {
+        conditions |= COND_CRITICAL_FAULT;
+    }
+    return conditions;
+}
+
+state_t StateMachine_PreviousState(void) {
+    uint8_t last = (transition_trace_index + TRANSITION_TRACE_LENGTH - 1) % TRANSITION_TRACE_LENGTH;
+    return (state_t)(transition_trace[last].from_to >> 4);
+}
+
+void StateMachine_Event(condition_t event) {
+    pending_events |= event;
+}
+
+void StateMachine_Transition(state_t next_state) {
+    if (next_state == state || state == CRITICAL_ERROR) {   //CRITICAL_ERROR is only left through RESET()
+        return;
+    }
+
+    transition_trace[transition_trace_index].from_to = (uint8_t) ((state << 4) | (next_state & 0x0F));
+    transition_trace[transition_trace_index].conditions = state_conditions;
+    transition_trace_index = (transition_trace_index + 1) % TRANSITION_TRACE_LENGTH;
+
+    if (state_table[state].exit != NULL) {
+        state_table[state].exit();
+    }
+    pending_events = 0;     //Events belong to the state that raised them
+    state = next_state;
+    if (state_table[state].entry != NULL) {
+        state_table[state].entry();
+    }
+}
+
+void StateMachine_Run(void) {
+    state_conditions = _EvaluateConditions() | pending_events;
+    pending_events = 0;
+
+    for (uint8_t i = 0; i < NUM_OF_TRANSITIONS; i++) {
+        const transition_t *row = &transition_table[i];
+        if (row->from == state && (state_conditions & row->mask) == row->match) {
+            if (row->action != NULL) {
+                row->action();
+            }
+            StateMachine_Transition(row->to);
+            return;
+        }
+    }
+
+    if (state_table[state].action != NULL) {
+        state_table[state].action();
+    }
+}
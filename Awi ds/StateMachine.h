@@ -0,0 +1,85 @@
+/*
+
+AWI-Dyson-BMS - Dyson Battery Management System Configuration
+Copyright (C) 2025 AWi
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program. If not, see https://www.gnu.org/licenses/.
+Note: As an addendum to the GNU General Public License, any hardware
+using this project’s code or information must publicly disclose
+complete electrical schematics and a bill of materials for such hardware.
+Acknowledgements:
+Thanks to tinfever, the author of version 1, for compiling
+and open-sourcing it.
+Thanks to Dr. Mark Roberts for his contributions to the V8 open-source code.
+Contact: 112460193@qq.com | www.awi.design
+(Website is currently under maintenance) */
+
+#ifndef STATE_MACHINE_H
+#define STATE_MACHINE_H
+
+#include "main.h"
+
+/* Condition bits. Guards are evaluated once per pass into a single bitmask (state_conditions)
+ * and the transition table is matched against it. COND_ACTION_DONE is an event rather than a
+ * guard: a state action raises it with StateMachine_Event() and it is seen on the next pass only.
+ */
+typedef uint16_t condition_t;
+
+#define COND_TRIGGER            (1u << 0)   // detect == TRIGGER
+#define COND_CHARGER            (1u << 1)   // detect == CHARGER
+#define COND_WKUP               (1u << 2)   // ISL WKUP_STATUS
+#define COND_SAFETY_OK          (1u << 3)   // safety.discharge_ok
+#define COND_MIN_CELL_OK        (1u << 4)   // minCellOK()
+#define COND_MAX_CELL_OK        (1u << 5)   // maxCellOK()
+#define COND_CHARGE_TEMP_OK     (1u << 6)   // safety.charge_ok
+#define COND_FULL_DISCHARGE     (1u << 7)   // full_discharge_flag
+#define COND_DISCHARGE_FET      (1u << 8)   // ISL discharge FET enabled (cached)
+#define COND_BALANCE_WANTED     (1u << 9)   // cellBalanceWanted()
+#define COND_SLEEP_TIMEOUT      (1u << 10)  // sleep_timeout_counter past the timeout for this state
+#define COND_LED_IDLE           (1u << 11)  // No LED pattern in progress
+#define COND_CHARGE_WAIT_DONE   (1u << 12)  // charge_wait_counter reached CHARGE_WAIT_TIMEOUT, or raised early by the taper check
+#define COND_SHORT_CHARGE       (1u << 13)  // charge pulse shorter than CHARGE_COMPELTE_TIMEOUT
+#define COND_ACTION_DONE        (1u << 14)  // Event raised by the state action on the previous pass
+#define COND_CRITICAL_FAULT     (1u << 15)  // Critical I2C error or ISL brown out latched in past_error_reason
+
+#define CONDITIONS_MET(bits) ((state_conditions & (bits)) == (bits))
+
+typedef struct {
+    state_t from;
+    condition_t mask;       // Conditions that are examined
+    condition_t match;      // Required value of the examined conditions
+    state_t to;
+    void (*action)(void);   // Optional transition action, runs before the exit action of "from"
+} transition_t;
+
+typedef struct {
+    void (*entry)(void);
+    void (*action)(void);   // Runs on every pass in which no transition was taken
+    void (*exit)(void);
+} state_actions_t;
+
+#define TRANSITION_TRACE_LENGTH 8
+
+typedef struct {
+    uint8_t from_to;            // From state in the high nibble, to state in the low nibble
+    condition_t conditions;     // Condition bitmask at the time of the transition
+} transition_trace_t;
+
+extern condition_t state_conditions;
+extern transition_trace_t transition_trace[TRANSITION_TRACE_LENGTH];
+extern uint8_t transition_trace_index;
+
+void StateMachine_Run(void);
+void StateMachine_Transition(state_t next_state);
+void StateMachine_Event(condition_t event);
+state_t StateMachine_PreviousState(void);
+
+#endif /* STATE_MACHINE_H */
@@ -35,16 +35,63 @@ const int8_t MIN_TEMP_C = -20;                  // Celsius. Charging and dischar
 const uint16_t MAX_DISCHARGE_CURRENT_mA = 30000; // Current limit for PIC measurement of current through the output shunt.
 const uint16_t MIN_DISCHARGE_CELL_VOLTAGE_mV = 2700; // Output disabled when min cell voltage goes below this value.
 const uint16_t MAX_CHARGE_CELL_VOLTAGE_mV = 4200;    // Charging stops when max cell voltage goes above this value.
+const uint16_t MIN_LOADED_CELL_VOLTAGE_mV = 2500;    // Hard floor under load when the cutoff is IR compensated.
+const uint16_t MAX_IR_COMPENSATION_mV = 400;         // Most the cutoff is lowered by the estimated IR drop.
+
+// Fault Debounce. A fault is only acted on once it is present in REQUIRED of the last WINDOW 32ms ticks (WINDOW 1-8),
+// so the filters take the same time in every state. While a fault is pending the idle states acquire every tick.
+// The ISL short circuit flag is never debounced.
+#define ISL_STATUS_FAULT_REQUIRED 2
+#define ISL_STATUS_FAULT_WINDOW 3
+#define SHUNT_OC_FAULT_REQUIRED 3       // Rides through motor inrush on trigger pull
+#define SHUNT_OC_FAULT_WINDOW 4
+#define TEMP_FAULT_REQUIRED 3           // Rejects single bad thermistor or ISL temperature reads
+#define TEMP_FAULT_WINDOW 5
 
 // Option to sleep after charge complete
 #define SLEEP_AFTER_CHARGE_COMPLETE
 
+// Option to put the PIC to sleep between loop iterations in IDLE, CHARGING_WAIT and ERROR
+#define ENABLE_TICKLESS_IDLE
+
+// Option to wake the PIC from SLEEP with interrupt-on-change on the charger/trigger detect pin. Only the charger level
+// is above the port's VIH, so trigger pulls still wait for the next one-tick WDT wake in IDLE (see armDetectWake()).
+#define ENABLE_DETECT_IOC_WAKE
+
+// Option to enable the discharge FET on a trigger edge from the last safety verdict, before the full checks run. The
+// edge is only seen once the PIC is awake, so in IDLE the latency is one WDT tick (32 ms nominal) plus the detect
+// conversion and one ISL register read.
+#define ENABLE_FAST_TRIGGER_PATH
+
+// Option to trip on discharge overcurrent with comparator C1 watching the shunt (RA0) against a DAC threshold derived from
+// MAX_DISCHARGE_CURRENT_mA. This is not a hardware cutoff: no PIC pin drives the FETs, so the interrupt only latches the trip
+// and the discharge FET is turned off over I2C when the transaction in progress ends, or at the top of the next loop pass if
+// the bus is idle. That takes milliseconds, not microseconds, but doesn't wait for the next dischargeIsense_mA() read. The
+// ISL94208's own overcurrent and short circuit detection stays the fast protection.
+// Enables global interrupts. The DAC is referenced to the 1.024V FVR and stays at the threshold instead of 0V between ADC reads.
+//#define ENABLE_COMPARATOR_OC_TRIP
+
+// Option to time each phase of the main loop with TMR1 and keep min/max/mean per phase and per state (see Profiler.h)
+//#define ENABLE_LOOP_PROFILER
+
 // Firmware Version
 #define FIRMWARE_VERSION 1
 
 // EEPROM Formatting Parameters
-#define EEPROM_START_OF_EVENT_LOGS_ADDR 0x20
-#define EEPROM_RUNTIME_TOTAL_STARTING_ADDR 0x1C  // 32-bit runtime counter in 0x1C, 0x1D, 0x1E, 0x1F
+#define EEPROM_LAYOUT_VERSION 1                  // init() formats the regions below when the stored version differs
+#define EEPROM_LAYOUT_VERSION_ADDR 0x18
+#define EEPROM_LAYOUT_FEATURES_ADDR 0x19         // EEPROM_LAYOUT_FEATURES the regions were formatted for
+#define EEPROM_START_OF_EVENT_LOGS_ADDR 0x20     // Compact event stream (see EEPROMLog.c)
+#define EEPROM_EVENT_DETAIL_ADDR 0xD0            // Full record of the newest distinct fault (see EEPROMLog.h)
+#define EEPROM_END_OF_EVENT_LOGS_ADDR 0xDF
+#define EEPROM_LAST_CHARGE_SESSION_ADDR 0x1A     // Last charge session: peak current in 50mA steps, duration in minutes
+#define EEPROM_RUNTIME_TOTAL_STARTING_ADDR 0x1C  // Layout 0 runtime counter in 0x1C-0x1F, only read to migrate it
+#define EEPROM_RUNTIME_JOURNAL_ADDR 0xE0         // Runtime journal, two 7-byte checkpoints then the delta ring up to 0xFF
+#define EEPROM_RUNTIME_JOURNAL_RING_SIZE 18
+#define RUNTIME_JOURNAL_TICKS_PER_DELTA 64       // ~2s per delta unit, one byte holds up to ~4 minutes of runtime
+#define EEPROM_WRITE_QUEUE_LENGTH 40             // Bytes waiting to be written. errorEntry() queues up to 39: a charge
+                                                 // record (12) or runtime checkpoint (7), a stream entry that starts a
+                                                 // block (11) and the detail record (16).
 
 // LED and I2C Pin Definitions
 #define redLED PSTR1CONbits.STR1C
@@ -60,6 +107,12 @@ const uint16_t MAX_CHARGE_CELL_VOLTAGE_mV = 4200;    // Charging stops when max
 #define ANS_SDA ANSELBbits.ANSB1
 #define ANS_SCL ANSELBbits.ANSB4
 
+// Charger/Trigger Detect Pin (RB5/AN7). The digital input buffer is only enabled while sleeping away from the trigger level.
+#define ANS_DETECT ANSELBbits.ANSB5
+#define IOCP_DETECT IOCBPbits.IOCBP5
+#define IOCN_DETECT IOCBNbits.IOCBN5
+#define IOCF_DETECT IOCBFbits.IOCBF5
+
 #define ISL_I2C_ADDR 0x50
 
 // ADC Channel Definitions
@@ -74,10 +127,96 @@ const uint16_t MAX_CHARGE_CELL_VOLTAGE_mV = 4200;    // Charging stops when max
 
 const uint8_t HYSTERESIS_TEMP_C = 3;
 
+// Discharge Shunt Comparator. DAC steps are FVR/32 = 32mV, the shunt node reads 500mA per mV.
+#define COMPARATOR_DAC_FVR_mV 1024
+#define DISCHARGE_ISENSE_mA_PER_mV 500
+
+// Watchdog Prescaler Definitions. WDT runs from the 31kHz LFINTOSC and wakes the PIC from SLEEP instead of resetting it.
+#define WDT_PERIOD_32ms 0b00101     // 1:1024, one TMR4 tick
+#define WDT_PERIOD_256ms 0b01000    // 1:8192
+#define WDT_PERIOD_512ms 0b01001    // 1:16384, MCC default used while running
+
+// Option to estimate cell internal resistance from load steps and lower the undervoltage cutoff by the IR drop at the
+// present current, so MIN_DISCHARGE_CELL_VOLTAGE_mV applies to the estimated open circuit voltage instead of the loaded one
+#define ENABLE_IR_COMPENSATED_CUTOFF
+#define IR_STEP_MIN_mA 2000         // Smallest current step used for an estimate
+#define IR_MIN_mOHM 5               // Estimates outside this range are thrown away
+#define IR_MAX_mOHM 150
+
+// Option to bleed the high cells through the ISL balance switches while the charger is connected (see CellBalance.c)
+#define ENABLE_CELL_BALANCING
+#define BALANCE_START_DELTA_mV 30   // Pack delta that starts balancing
+#define BALANCE_STOP_DELTA_mV 10    // Balancing stops at this delta. Cells more than this above the lowest are bled.
+#define BALANCE_MIN_CELL_mV 3900    // Only balance near the top of charge, where cell voltage tracks state of charge
+#define BALANCE_MAX_TEMP_C 45       // The balance resistors heat the ISL, stop below its own overtemp limit
+
+// Option to end each CHARGING_WAIT as soon as the top cell has relaxed instead of after CHARGE_WAIT_TIMEOUT, and to declare
+// the pack full when the relaxation shows the charge current has tapered off. CHARGE_WAIT_TIMEOUT becomes the upper bound.
+#define ENABLE_TAPER_CHARGE_TERMINATION
+#define TAPER_SETTLED_mV 2          // Top cell is relaxed once it drops less than this per CHARGING_WAIT acquisition...
+#define TAPER_SETTLED_SAMPLES 3     // ...this many times in a row
+#define TAPER_FULL_SAG_mV 30        // Full when the top cell relaxed less than this from the end of the pulse (low current)...
+#define TAPER_FULL_RELAXED_mV 4170  // ...or relaxed voltage is still above this
+
+// Option to estimate charge current and time to full, and keep the last session's peak current and duration in EEPROM.
+// Off by default: v6beta4.hex leaves ~138 words of flash free. Check the xc8 memory summary before enabling this, the
+// usage histograms or the cell health log.
+//#define ENABLE_CHARGE_MONITOR
+#define CHARGE_ISENSE_STEP_TICKS 4          // Pack voltage step is read this long after the charge FET closes
+#define CHARGE_ISENSE_DEFAULT_IR_mOHM 30    // Used until updateCellResistance() has seen a load step
+#define TTF_SAMPLE_TICKS 1875               // Top cell rise rate is sampled once a minute
+#define TTF_TOP_OF_CHARGE_MIN 15            // Allowance for the pulse charging once the top cell reaches the limit
+// Option to blink the time to full (one blue blink per 10 minutes) instead of solid blue while charging
+//#define ENABLE_CHARGE_TIME_TO_FULL_LED
+
+// Option to keep lifetime usage histograms in EEPROM (see Histograms.h). Off by default, see ENABLE_CHARGE_MONITOR.
+//#define ENABLE_USAGE_HISTOGRAMS
+#define HISTOGRAM_FLUSH_TICKS 18750     // 10 minutes awake between flushes
+
+// Option to keep per-cell end of charge and cutoff deviations, IR estimates and min/max rank counts in EEPROM (see CellHealth.c).
+// Off by default, see ENABLE_CHARGE_MONITOR.
+//#define ENABLE_CELL_HEALTH_LOG
+
+// Option to check each cell against the cutoff as it is read during discharge, sampling output current between cells,
+// and abort the rest of the scan as soon as a limit is crossed
+#define ENABLE_EARLY_ABORT_CELL_SCAN
+
 // Cell Voltage Rolling Average
 #define ENABLE_CELL_VOLTAGE_ROLLING_AVERAGE
 #define CELLVOLTAGE_AVERAGE_WINDOW_SIZE 4
 
+// EEPROM regions of the options above, after them so the #ifdefs see them. They are packed down from
+// EEPROM_EVENT_DETAIL_ADDR and only take space when their option is enabled. The event stream gets the rest:
+// 5 blocks of 35 bytes with all three off, 5 of 17 with all three on.
+#ifdef ENABLE_USAGE_HISTOGRAMS
+#define EEPROM_HISTOGRAM_SIZE 42                 // Lifetime usage counters, HIST_SIZE (see Histograms.h)
+#define EEPROM_HISTOGRAM_FEATURE 0x01
+#else
+#define EEPROM_HISTOGRAM_SIZE 0
+#define EEPROM_HISTOGRAM_FEATURE 0
+#endif
+#ifdef ENABLE_CELL_HEALTH_LOG
+#define EEPROM_CELL_HEALTH_SIZE 28               // Per-cell health and pack delta trend, CELL_HEALTH_SIZE (see CellHealth.h)
+#define EEPROM_CELL_HEALTH_FEATURE 0x02
+#else
+#define EEPROM_CELL_HEALTH_SIZE 0
+#define EEPROM_CELL_HEALTH_FEATURE 0
+#endif
+#define EEPROM_CHARGE_RECORD_SLOTS 2
+#ifdef ENABLE_CHARGE_MONITOR
+#define EEPROM_CHARGE_RECORD_SIZE 18             // Charge session records, slots x CHARGE_RECORD_SIZE (see ChargeMonitor.h)
+#define EEPROM_CHARGE_RECORD_FEATURE 0x04
+#else
+#define EEPROM_CHARGE_RECORD_SIZE 0
+#define EEPROM_CHARGE_RECORD_FEATURE 0
+#endif
+#define EEPROM_LAYOUT_FEATURES (EEPROM_HISTOGRAM_FEATURE | EEPROM_CELL_HEALTH_FEATURE | EEPROM_CHARGE_RECORD_FEATURE)
+#define EEPROM_HISTOGRAM_ADDR (EEPROM_EVENT_DETAIL_ADDR - EEPROM_HISTOGRAM_SIZE)
+#define EEPROM_CELL_HEALTH_ADDR (EEPROM_HISTOGRAM_ADDR - EEPROM_CELL_HEALTH_SIZE)
+#define EEPROM_CHARGE_RECORD_ADDR (EEPROM_CELL_HEALTH_ADDR - EEPROM_CHARGE_RECORD_SIZE)
+#define EEPROM_EVENT_STREAM_BLOCKS 5             // Starting a block drops the oldest, so keep at least 3
+#define EEPROM_EVENT_BLOCK_SIZE ((EEPROM_CHARGE_RECORD_ADDR - EEPROM_START_OF_EVENT_LOGS_ADDR) / EEPROM_EVENT_STREAM_BLOCKS)
+
 #ifdef __cplusplus
 extern "C" {
 #endif
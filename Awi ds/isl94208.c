@@ -25,6 +25,7 @@ Contact: 112460193@qq.com | www.awi.design
 #include "isl94208.h"
 #include "FaultHandling.h"
 #include "main.h"
+#include "StateMachine.h"
 
 
 //Private functions
@@ -60,13 +61,61 @@ void ISL_Init(void){
     ISL_SetSpecificBits(ISL.ENABLE_CHARGE_FET, 0);
 }
 
+#ifdef ENABLE_COMPARATOR_OC_TRIP
+/* The FETs are only reachable over I2C, and calling the I2C driver from the ISR as well as the main
+ * loop makes XC8 duplicate the whole driver. The comparator ISR only marks the cutoff pending. The
+ * main loop sends it as soon as it has no transaction or read-modify-write in progress: from the
+ * last transaction to finish, or from ISL_DischargeCutoffService() when the bus is idle. Sending it
+ * after a read-modify-write of FETControl means that write can't turn the FET back on. The depth
+ * count covers ISL_SetSpecificBits() calling Read then Write.
+ */
+static uint8_t isl_bus_depth = 0;
+static volatile bool discharge_cutoff_pending = false;
+
+static void _DischargeCutoff(void){
+    uint8_t fets_off = 0;
+    discharge_cutoff_pending = false;
+    I2C_ERROR_FLAGS |= I2C1_WriteMemory(ISL_I2C_ADDR, FETControl, &fets_off, 1);
+}
+
+static void _BusClaim(void){
+    isl_bus_depth++;
+}
+
+static void _BusRelease(void){
+    isl_bus_depth--;
+    if (isl_bus_depth == 0 && discharge_cutoff_pending) {
+        _DischargeCutoff();
+    }
+}
+
+void ISL_DischargeCutoffFromISR(void){
+    discharge_cutoff_pending = true;
+}
+
+void ISL_DischargeCutoffService(void){
+    if (discharge_cutoff_pending) {
+        _DischargeCutoff();
+    }
+}
+#define BUS_CLAIM() _BusClaim()
+#define BUS_RELEASE() _BusRelease()
+#else
+#define BUS_CLAIM()
+#define BUS_RELEASE()
+#endif
+
 uint8_t ISL_Read_Register(isl_reg_t reg){  //Allows easily retrieving an entire register. Ex. ISL_Read_Register(ISL_CONFIG_REG); result = ISL_RegData[Config]
+    BUS_CLAIM();
     I2C_ERROR_FLAGS |= I2C1_ReadMemory(ISL_I2C_ADDR, reg, &ISL_RegData[reg], 1);
+    BUS_RELEASE();
     return ISL_RegData[reg];
 }
 
 void ISL_Write_Register(isl_reg_t reg, uint8_t wrdata){
+     BUS_CLAIM();
      I2C_ERROR_FLAGS |= I2C1_WriteMemory(ISL_I2C_ADDR, reg, &wrdata, 1);
+     BUS_RELEASE();
      #ifdef __DEBUG
     ISL_Read_Register(reg);    //Re-read the I2C register so we can confirm any changes by watching variable values in debug.
     #endif
@@ -86,8 +135,10 @@ void ISL_SetSpecificBits(const isl_locate_t params[3], uint8_t value){
     uint8_t reg_addr = params[REG_ADDRESS];
     uint8_t bit_addr = params[BIT_ADDRESS];
     uint8_t bit_length = params[BIT_LENGTH];
+    BUS_CLAIM();
     uint8_t data = (ISL_Read_Register(reg_addr) & ~(_GenerateMask(bit_length) << bit_addr)) | (uint8_t) (value << bit_addr);      //Take the read data from the I2C register, zero out the bits we are setting, then OR in our data
     ISL_Write_Register(reg_addr, data);   //Doing bitwise OR with previous result so we can determine if multiple errors occur
+    BUS_RELEASE();
 }
 
 uint8_t ISL_GetSpecificBits(const isl_locate_t params[3]){
@@ -105,9 +156,7 @@ uint8_t ISL_GetSpecificBits_cached(const isl_locate_t params[3]){     //Can be u
 }
 
 uint16_t ISL_GetAnalogOutmV(isl_analogout_t value){
-    DAC_SetOutput(0);   //Make sure DAC is set to 0V
-    ADC_SelectChannel(ADC_PIC_DAC); //Connect ADC to 0V to empty internal ADC sample/hold capacitor
-    __delay_us(1);  //Wait a little bit
+    ADCPrepare();   //Connect ADC to the DAC to empty internal ADC sample/hold capacitor
     ADC_SelectChannel(ADC_ISL_OUT); //Connect ADC to analog out of ISL94208
     ISL_SetSpecificBits(ISL.ANALOG_OUT_SELECT_4bits, value);    //Set the ISL to output desired signal on analog out
     __delay_us(100); //ISL94208 has maximum analog output stabilization time of 0.1ms = 100us
@@ -116,62 +165,104 @@ uint16_t ISL_GetAnalogOutmV(isl_analogout_t value){
     return _ConvertADCtoMV(result); //returns analog output in mV
 }
 
-void ISL_ReadAllCellVoltages(void){
+/* Reads the six cells and keeps cellstats up to date as each one lands, so there is no second pass.
+ * Returns false if the scan was aborted. Cells skipped by an aborted scan keep their previous reading.
+ */
+bool ISL_ReadAllCellVoltages(void){
     //Added rolling average to tolerate brief voltage dips during startup using marginal battery cells
     //This might not actually matter much depending on how large the inrush current is on the vacuum and how poor health the battery cells are.
     #ifdef ENABLE_CELL_VOLTAGE_ROLLING_AVERAGE
     static uint8_t num_iterations = 1;
-    
-    CellVoltageHistory[OldestVoltageIndex][1] = ISL_GetAnalogOutmV(AO_VCELL1)*2; //Cell voltages have to be multiplied by two since ISL scales them down by two.
-    CellVoltageHistory[OldestVoltageIndex][2] = ISL_GetAnalogOutmV(AO_VCELL2)*2;
-    CellVoltageHistory[OldestVoltageIndex][3] = ISL_GetAnalogOutmV(AO_VCELL3)*2;
-    CellVoltageHistory[OldestVoltageIndex][4] = ISL_GetAnalogOutmV(AO_VCELL4)*2;
-    CellVoltageHistory[OldestVoltageIndex][5] = ISL_GetAnalogOutmV(AO_VCELL5)*2;
-    CellVoltageHistory[OldestVoltageIndex][6] = ISL_GetAnalogOutmV(AO_VCELL6)*2;
-    
-    for (uint8_t cell = 1; cell <= 6; cell++){
-        uint16_t sum = 0;
-        for (uint8_t datapoint = 0; datapoint < CELLVOLTAGE_AVERAGE_WINDOW_SIZE; datapoint++){
-            sum += CellVoltageHistory[datapoint][cell];
-        }
-        CellVoltages[cell] = sum/(num_iterations);      //num_iterations will increment up to WINDOW_SIZE. This ensures that during startup, when some of the historical data points are zero, they aren't included in the average causing an instant undervoltage cutout.
-
-    }    
-    OldestVoltageIndex = (OldestVoltageIndex + 1) % CELLVOLTAGE_AVERAGE_WINDOW_SIZE;
-    if (num_iterations < CELLVOLTAGE_AVERAGE_WINDOW_SIZE){
-        num_iterations++;
-    }
     #endif
-    
-    #ifndef ENABLE_CELL_VOLTAGE_ROLLING_AVERAGE
-    CellVoltages[1] = ISL_GetAnalogOutmV(AO_VCELL1)*2; //Cell voltages have to be multiplied by two since ISL scales them down by two.
-    CellVoltages[2] = ISL_GetAnalogOutmV(AO_VCELL2)*2;
-    CellVoltages[3] = ISL_GetAnalogOutmV(AO_VCELL3)*2;
-    CellVoltages[4] = ISL_GetAnalogOutmV(AO_VCELL4)*2;
-    CellVoltages[5] = ISL_GetAnalogOutmV(AO_VCELL5)*2;
-    CellVoltages[6] = ISL_GetAnalogOutmV(AO_VCELL6)*2;
+    bool discharging = false;
+    bool sample_current = false;
+    bool scanning = true;
+    bool below_cutoff = false;
+    bool overcurrent = false;
+    uint8_t cell = 1;
+    #if defined(ENABLE_EARLY_ABORT_CELL_SCAN) || defined(ENABLE_IR_COMPENSATED_CUTOFF)
+    sample_current = (state == OUTPUT_EN);
     #endif
-}
+    #ifdef ENABLE_EARLY_ABORT_CELL_SCAN
+    //While discharging, start with the cell that was lowest last time and stop the scan at the first limit crossed.
+    discharging = (state == OUTPUT_EN);
+    if (discharging && cellstats.mincellnum != 0){
+        cell = cellstats.mincellnum;
+    }
+    #endif
+
+    uint8_t mincell = cell;
+    uint8_t maxcell = cell;
+    uint16_t pack_mV = 0;
+    uint16_t pack_raw_mV = 0;
+    uint8_t changed_mask = 0;
 
-void ISL_calcCellStats(void){
-    uint8_t maxcell = 1;    //Start by assuming max cell is 1
-    uint8_t mincell = 1;    //Start by assuming min cell is 1
-    for (uint8_t i = 2; i <= 6; i++){   //We can start with cell 2 since we already assumed cell 1 is max/min until proved otherwise.
-        if (CellVoltages[i] > CellVoltages[maxcell]){
-            maxcell = i;    //If this cell is higher that the currently recorded max cell voltage, make it the new max cell.
+    for (uint8_t i = 0; i < 6; i++){
+        if (scanning){
+            if (sample_current){
+                discharge_current_mA = dischargeIsense_mA();    //Sample the output current with each cell instead of once per scan
+                overcurrent |= (discharge_current_mA >= MAX_DISCHARGE_CURRENT_mA);
+            }
+            uint16_t raw_mV = ISL_GetAnalogOutmV((isl_analogout_t)(AO_VCELL1 + cell - 1))*2; //Cell voltages have to be multiplied by two since ISL scales them down by two.
+            uint16_t cell_mV = raw_mV;
+            pack_raw_mV += raw_mV;
+            #ifdef ENABLE_CELL_VOLTAGE_ROLLING_AVERAGE
+            CellVoltageHistory[OldestVoltageIndex][cell] = raw_mV;
+            uint16_t sum = 0;
+            for (uint8_t datapoint = 0; datapoint < CELLVOLTAGE_AVERAGE_WINDOW_SIZE; datapoint++){
+                sum += CellVoltageHistory[datapoint][cell];
+            }
+            cell_mV = sum/(num_iterations);     //num_iterations will increment up to WINDOW_SIZE. This ensures that during startup, when some of the historical data points are zero, they aren't included in the average causing an instant undervoltage cutout.
+            #endif
+            if (CellVoltages[cell] != cell_mV){
+                changed_mask |= (uint8_t)(1 << cell);
+            }
+            CellVoltages[cell] = cell_mV;
+
+            #ifdef ENABLE_IR_COMPENSATED_CUTOFF
+            below_cutoff |= (raw_mV <= minCellCutoff_mV());     //The rolling average lags a load change, the raw reading goes with the current sampled with it
+            #else
+            below_cutoff |= (cell_mV <= minCellCutoff_mV());
+            #endif
+            if (discharging){
+                scanning = (!below_cutoff && !overcurrent);     //The rest of the cells can wait, minCellOK() or the shunt filter acts on this one
+            }
+        }
+
+        pack_mV += CellVoltages[cell];
+        if (CellVoltages[cell] > CellVoltages[maxcell]){
+            maxcell = cell;     //If this cell is higher that the currently recorded max cell voltage, make it the new max cell.
         }
-        if (CellVoltages[i] < CellVoltages[mincell]){
-            mincell = i;    //If this cell is lower that the currently recorded max cell voltage, make it the new min cell.
+        if (CellVoltages[cell] < CellVoltages[mincell]){
+            mincell = cell;     //If this cell is lower that the currently recorded min cell voltage, make it the new min cell.
         }
+        cell = (cell % 6) + 1;
     }
+
     cellstats.maxcellnum = maxcell;
     cellstats.maxcell_mV = CellVoltages[maxcell];
     cellstats.mincellnum = mincell;
     cellstats.mincell_mV = CellVoltages[mincell];
     cellstats.packdelta_mV = cellstats.maxcell_mV - cellstats.mincell_mV;
-}
-
+    cellstats.pack_mV = pack_mV;
+    cellstats.pack_raw_mV = pack_raw_mV;
+    cellstats.changed_mask = changed_mask;
+    cellstats.below_cutoff = below_cutoff;
+    cellstats.overcurrent = overcurrent;
+    if (changed_mask){
+        cellstats.revision++;
+    }
 
+    #ifdef ENABLE_CELL_VOLTAGE_ROLLING_AVERAGE
+    if (scanning){
+        OldestVoltageIndex = (OldestVoltageIndex + 1) % CELLVOLTAGE_AVERAGE_WINDOW_SIZE;     //Only advanced on a full scan so an aborted scan's samples are rewritten next time
+        if (num_iterations < CELLVOLTAGE_AVERAGE_WINDOW_SIZE){
+            num_iterations++;
+        }
+    }
+    #endif
+    return scanning;
+}
 
 int16_t ISL_GetInternalTemp(void){
     int16_t adcval = (int16_t) ISL_GetAnalogOutmV(AO_INTTEMP);
@@ -186,7 +277,7 @@ bool ISL_BrownOutHandler(void){
             setErrorReasonFlags(&past_error_reason);
             I2C1_Init();    //Attempting to recover I2C bus as a last ditch effort to turn off MOSFETs before erroring out. Might not be useful.
             ClearI2CBus();
-            state = ERROR;
+            StateMachine_Transition(ERROR);
             return true;
         }
     return false;
@@ -187,7 +187,12 @@ struct {
     uint16_t maxcell_mV;    //Voltage of highest voltage cell in mV
     uint16_t mincell_mV;    //Voltage of lowest voltage cell in mV
     uint16_t packdelta_mV;  //mV difference between high and lowest voltage cells
-    
+    uint16_t pack_mV;       //Sum of all six cells in mV
+    uint16_t pack_raw_mV;   //Sum of the latest readings before the rolling average, only valid after a full scan
+    uint8_t changed_mask;   //Bit n set if cell n changed on the latest scan
+    bool below_cutoff;      //A cell read on the latest scan was at or below minCellCutoff_mV()
+    bool overcurrent;       //A current sample of the latest scan was at or above MAX_DISCHARGE_CURRENT_mA
+    uint8_t revision;       //Incremented on every scan that changed a cell. Consumers compare against the last value they saw.
 } cellstats;
 
 void ISL_Init(void);
@@ -197,10 +202,13 @@ void ISL_SetSpecificBits(const isl_locate_t params[3], uint8_t value);
 uint8_t ISL_GetSpecificBits(const isl_locate_t params[3]);
 uint8_t ISL_GetSpecificBits_cached(const isl_locate_t params[3]);
 uint16_t ISL_GetAnalogOutmV(isl_analogout_t value);
-void ISL_ReadAllCellVoltages(void);
+bool ISL_ReadAllCellVoltages(void);
 int16_t ISL_GetInternalTemp(void);
-void ISL_calcCellStats(void);
 bool ISL_BrownOutHandler(void);
+#ifdef ENABLE_COMPARATOR_OC_TRIP
+void ISL_DischargeCutoffFromISR(void);
+void ISL_DischargeCutoffService(void);
+#endif
 
 
 
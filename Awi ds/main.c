@@ -30,9 +30,16 @@ Contact: 112460193@qq.com | www.awi.design
 #include "thermistor.h"
 #include "LED.h"
 #include "FaultHandling.h"
-
-volatile error_reason_t current_error_reason = {0};
-volatile error_reason_t past_error_reason = {0};
+#include "Profiler.h"
+#include "StateMachine.h"
+#include "CellBalance.h"
+#include "ChargeMonitor.h"
+#include "EEPROMLog.h"
+#include "Histograms.h"
+#include "CellHealth.h"
+
+volatile error_reason_t current_error_reason = 0;
+volatile error_reason_t past_error_reason = 0;
 modelnum_t modelnum;
 state_t state;
 detect_t detect;
@@ -44,9 +51,17 @@ counter_t charge_wait_counter = {0, false};
 counter_t nonblocking_wait_counter = {0, false};
 counter_t error_timeout_wait_counter = {0, false};
 counter_t LED_code_cycle_counter = {0, false};
+counter_t acquisition_wait_counter = {0, false};
+counter_t discharge_ready_age_counter = {0, false};
+counter_t critical_retry_counter = {0, false};
+counter_t balance_cycle_counter = {0, false};
+counter_t charge_session_counter = {0, false};
+counter_t uptime_counter = {0, true};
 bool full_discharge_flag = false;
 bool charge_complete_flag = false;
+bool discharge_ready_flag = false;
 uint16_t discharge_current_mA = 0;
+uint16_t peak_discharge_current_mA = 0;
 int16_t isl_int_temp;
 int16_t thermistor_temp;
 uint8_t I2C_error_counter = 0;
@@ -100,7 +115,9 @@ static uint16_t ConvertADCtoMV(uint16_t adcval) {
 }
 
 void ADCPrepare(void) {
-    DAC_SetOutput(0);
+#ifndef ENABLE_COMPARATOR_OC_TRIP
+    DAC_SetOutput(0);   // With the comparator trip the DAC stays at its ~64mV threshold, close enough to empty the sample cap
+#endif
     ADC_SelectChannel(ADC_PIC_DAC);
     __delay_us(1);
 }
@@ -127,6 +144,31 @@ detect_t checkDetect(void) {
     }
 }
 
+// The trigger level (DETECT_TRIGGER_THRESH_mV to DETECT_CHARGER_THRESH_mV) sits below VIH, so only charger edges are
+// seen by IOC. RB5 has no comparator input and the ISL's WKUP line doesn't reach the PIC, so trigger pulls are picked
+// up by the next WDT wake, which lowPowerWait() keeps at one tick in IDLE. With the pin at the trigger level the input
+// buffer would sit at mid-rail and draw current, so it stays analog and nothing is armed.
+void armDetectWake(void) {
+    if (detect == TRIGGER) {
+        return;
+    }
+    ANS_DETECT = 0;
+    IOCF_DETECT = 0;
+    IOCP_DETECT = 1;                    // Charger connected
+    IOCN_DETECT = (detect == CHARGER);  // Charger removed
+    INTCONbits.IOCIE = 1;   // With GIE clear the wake resumes after SLEEP() without vectoring. Otherwise the ISR just disarms IOCIE.
+}
+
+bool disarmDetectWake(void) {
+    bool woke_on_detect = IOCF_DETECT;
+    INTCONbits.IOCIE = 0;
+    IOCP_DETECT = 0;
+    IOCN_DETECT = 0;
+    IOCF_DETECT = 0;
+    ANS_DETECT = 1;
+    return woke_on_detect;
+}
+
 modelnum_t checkModelNum(void) {
     uint16_t isl_thermistor_reading = ISL_GetAnalogOutmV(AO_EXTTEMP);
     uint16_t pic_thermistor_reading = readADCmV(ADC_THERMISTOR);
@@ -142,7 +184,13 @@ void init(void) {
     I2C_ERROR_FLAGS = 0;
     SYSTEM_Initialize();
     TMR4_StartTimer();
+#ifdef ENABLE_LOOP_PROFILER
+    Profiler_Init();
+#endif
     DAC_SetOutput(0);
+#ifdef ENABLE_COMPARATOR_OC_TRIP
+    comparatorOCInit();
+#endif
     TRIS_SDA = 1;
     TRIS_SCL = 1;
     ANS_SDA = 0;
@@ -154,51 +202,101 @@ void init(void) {
     }
     modelnum = checkModelNum();
 
-    total_runtime_counter.value = (uint32_t) DATAEE_ReadByte(EEPROM_RUNTIME_TOTAL_STARTING_ADDR) << 24;
-    total_runtime_counter.value |= (uint32_t) DATAEE_ReadByte(EEPROM_RUNTIME_TOTAL_STARTING_ADDR+1) << 16;
-    total_runtime_counter.value |= (uint32_t) DATAEE_ReadByte(EEPROM_RUNTIME_TOTAL_STARTING_ADDR+2) << 8;
-    total_runtime_counter.value |= (uint32_t) DATAEE_ReadByte(EEPROM_RUNTIME_TOTAL_STARTING_ADDR+3);
+    EEPROMLog_Init();
+    total_runtime_counter.value = EEPROMLog_RecoverRuntime();
     state = IDLE;
 }
 void sleep(void) {
 #ifdef __DEBUG_DONT_SLEEP
-    state = IDLE;
+    StateMachine_Event(COND_ACTION_DONE);
     return;
 #endif
     resetLEDBlinkPattern();
+#ifdef ENABLE_USAGE_HISTOGRAMS
+    Histograms_Flush();
+#endif
+    EEPROMLog_Flush();      // The ISL drops our supply
     ISL_SetSpecificBits(ISL.SLEEP, 1);
     __delay_us(50);
     ISL_SetSpecificBits(ISL.SLEEP, 0);
     __delay_us(50);
     ISL_SetSpecificBits(ISL.SLEEP, 1);
+#ifdef ENABLE_DETECT_IOC_WAKE
+    // The ISL normally drops our supply here. If it doesn't, wait in SLEEP instead of spinning,
+    // and go straight back to IDLE if the trigger or charger changes while we wait.
+    CLRWDT();
+    WDTCONbits.WDTPS = WDT_PERIOD_256ms;
+    armDetectWake();
+    SLEEP();
+    NOP();
+    bool woke_on_detect = disarmDetectWake();
+    WDTCONbits.WDTPS = WDT_PERIOD_512ms;
+    CLRWDT();
+#else
     __delay_ms(250);
+#endif
     ClearI2CBus();
     ISL_Init();
+#ifdef ENABLE_DETECT_IOC_WAKE
+    if (woke_on_detect) {
+        StateMachine_Event(COND_ACTION_DONE);   // Back to IDLE through the transition table
+    }
+#endif
+}
+
+static bool previous_detect_was_charger = false;
+static bool show_cell_delta_LEDs = true;
+
+void idleExit(void) {
+    sleep_timeout_counter.enable = false;
+    resetLEDBlinkPattern();
+    previous_detect_was_charger = false;
+    show_cell_delta_LEDs = true;
+}
+
+void startDischarge(void) {
+    ISL_SetSpecificBits(ISL.ENABLE_DISCHARGE_FET, 1);
+    resetLEDBlinkPattern();
+    total_runtime_counter.enable = true;
+    peak_discharge_current_mA = 0;
+#ifdef ENABLE_CELL_HEALTH_LOG
+    CellHealth_StartDischarge();
+#endif
+}
+
+void markFullDischarge(void) {
+    full_discharge_flag = true;
+#ifdef ENABLE_CELL_HEALTH_LOG
+    CellHealth_Cutoff();
+#endif
+}
+
+void markChargeComplete(void) {
+    charge_complete_flag = true;
+#ifdef ENABLE_CHARGE_MONITOR
+    chargeMonitorSessionEnd(CHARGE_END_COMPLETE);
+#endif
+#ifdef ENABLE_USAGE_HISTOGRAMS
+    Histograms_ChargeComplete();
+#endif
+#ifdef ENABLE_CELL_HEALTH_LOG
+    CellHealth_EndOfCharge();
+#endif
+    Set_LED_RGB(0b000, 0);
 }
 
 void idle(void) {
-    static bool previous_detect_was_charger = false;
-    static bool show_cell_delta_LEDs = true;
-
-    if (detect == TRIGGER
-        && minCellOK()
-        && ISL_GetSpecificBits_cached(ISL.WKUP_STATUS)
-        && full_discharge_flag == false
-        && safetyChecks()
-    ) {
-        state = OUTPUT_EN;
-    } else if (detect == TRIGGER
-        && full_discharge_flag == true
-    ) {
-        state = ERROR;
-    } else if (detect == CHARGER
-            && charge_complete_flag == false
-            && maxCellOK()
-            && ISL_GetSpecificBits_cached(ISL.WKUP_STATUS)
-            && safetyChecks()
+#ifdef ENABLE_CHARGE_MONITOR
+    if (detect != CHARGER) {
+        chargeMonitorSessionEnd(CHARGE_END_REMOVED);  // No-op when no session is running. Between pulses the session stays open.
+    }
+#endif
+
+    if (CONDITIONS_MET(COND_CHARGER | COND_MAX_CELL_OK | COND_WKUP | COND_SAFETY_OK)
+        && charge_complete_flag == false
     ) {
         if ((show_cell_delta_LEDs && cellDeltaLEDIndicator()) || !show_cell_delta_LEDs) {
-            state = CHARGING;
+            StateMachine_Event(COND_ACTION_DONE);   // Charger gate open, the transition table moves us to CHARGING
         }
     } else if ((detect == NONE
 #ifdef SLEEP_AFTER_CHARGE_COMPLETE
@@ -206,24 +304,22 @@ void idle(void) {
 #endif
             )
 #ifndef SLEEP_AFTER_CHARGE_COMPLETE
-            && ISL_GetSpecificBits_cached(ISL.WKUP_STATUS) == 0
+            && !CONDITIONS_MET(COND_WKUP)
 #endif
             && sleep_timeout_counter.enable == false
-            && safetyChecks()
+            && CONDITIONS_MET(COND_SAFETY_OK)
     ) {
         sleep_timeout_counter.value = 0;
         sleep_timeout_counter.enable = true;
         show_cell_delta_LEDs = true;
-    } else if (!safetyChecks()) {
-        state = ERROR;
     } else if (detect == CHARGER
             && charge_complete_flag == false
-            && !maxCellOK()
+            && !CONDITIONS_MET(COND_MAX_CELL_OK)
     ) {
         charge_complete_flag = true;
     } else if (detect == CHARGER && charge_complete_flag) {
         Set_LED_RGB(0b000, 0);
-    } else if (detect == CHARGER && ISL_GetSpecificBits_cached(ISL.WKUP_STATUS)) {
+    } else if (detect == CHARGER && CONDITIONS_MET(COND_WKUP)) {
         Set_LED_RGB(0b110, 1023);
     } else if (detect == NONE) {
         if (CheckStateInDetectHistory(CHARGER)) {
@@ -232,19 +328,23 @@ void idle(void) {
 
         if ((previous_detect_was_charger && cellDeltaLEDIndicator()) || !previous_detect_was_charger) {
             previous_detect_was_charger = false;
-            uint8_t breath_count;
-            uint16_t pack_voltage = cellstats.mincell_mV;
-            if (pack_voltage < 3300) {
-                breath_count = 1;
-            } else if (pack_voltage < 3660) {
-                breath_count = 2;
-            } else {
-                breath_count = 3;
+            static uint8_t breath_count = 1;
+            static uint8_t breath_count_revision = 0xFF;
+            if (breath_count_revision != cellstats.revision) {
+                breath_count_revision = cellstats.revision;
+                uint16_t pack_voltage = cellstats.mincell_mV;
+                if (pack_voltage < 3300) {
+                    breath_count = 1;
+                } else if (pack_voltage < 3660) {
+                    breath_count = 2;
+                } else {
+                    breath_count = 3;
+                }
             }
             ledBreathe(0b110, breath_count, 1500);
             show_cell_delta_LEDs = true;
         }
-    } else if (detect == TRIGGER && ISL_GetSpecificBits_cached(ISL.WKUP_STATUS) && !full_discharge_flag) {
+    } else if (detect == TRIGGER && CONDITIONS_MET(COND_WKUP) && !full_discharge_flag) {
         Set_LED_RGB(0b110, 1023);
     }
 
@@ -255,126 +355,122 @@ void idle(void) {
 
     if (detect != CHARGER) {
         charge_complete_flag = false;
+#ifdef ENABLE_CELL_BALANCING
+        cellBalanceChargerRemoved();
+#endif
     }
 
-    if (!full_discharge_flag && !minCellOK() && detect != CHARGER) {
+    if (!full_discharge_flag && !CONDITIONS_MET(COND_MIN_CELL_OK) && detect != CHARGER) {
         full_discharge_flag = true;
     }
-
-    if (sleep_timeout_counter.value > IDLE_SLEEP_TIMEOUT && sleep_timeout_counter.enable) {
-        sleep_timeout_counter.enable = false;
-        sleep_timeout_counter.value = 0;
-        state = SLEEP;
-    }
-
-    if (state != IDLE) {
-        sleep_timeout_counter.enable = false;
-        resetLEDBlinkPattern();
-        previous_detect_was_charger = false;
-        show_cell_delta_LEDs = true;
-    }
 }
 
 void charging(void) {
-    if (!ISL_GetSpecificBits_cached(ISL.ENABLE_CHARGE_FET)
-        && detect == CHARGER
-        && maxCellOK()
-        && ISL_GetSpecificBits_cached(ISL.WKUP_STATUS)
-        && safetyChecks()
-        && chargeTempCheck()
-    ) {
+    if (!ISL_GetSpecificBits_cached(ISL.ENABLE_CHARGE_FET)) {
         charge_duration_counter.value = 0;
         charge_duration_counter.enable = true;
         ISL_SetSpecificBits(ISL.ENABLE_CHARGE_FET, 1);
         full_discharge_flag = false;
         resetLEDBlinkPattern();
-        Set_LED_RGB(0b001, 1023);
-    } else if (ISL_GetSpecificBits_cached(ISL.ENABLE_CHARGE_FET)
-        && detect == CHARGER
-        && maxCellOK()
-        && ISL_GetSpecificBits_cached(ISL.WKUP_STATUS)
-        && safetyChecks()
-        && chargeTempCheck()
-    ) {
-        Set_LED_RGB(0b001, 1023);
-    } else if (!maxCellOK()) {
-        ISL_SetSpecificBits(ISL.ENABLE_CHARGE_FET, 0);
-        charge_duration_counter.enable = false;
-        if (charge_duration_counter.value < CHARGE_COMPELTE_TIMEOUT) {
-            charge_complete_flag = true;
-            state = IDLE;
-            Set_LED_RGB(0b000, 0);
-        } else {
-            state = CHARGING_WAIT;
-        }
-    } else if (!safetyChecks() || !chargeTempCheck()) {
-        ISL_SetSpecificBits(ISL.ENABLE_CHARGE_FET, 0);
-        charge_duration_counter.enable = false;
-        Set_LED_RGB(0b110, 1023);
-        state = ERROR;
-    } else {
-        ISL_SetSpecificBits(ISL.ENABLE_CHARGE_FET, 0);
-        charge_duration_counter.enable = false;
-        state = IDLE;
+#ifdef ENABLE_CHARGE_MONITOR
+        chargeMonitorPulseStart();
+#endif
     }
-
-    if (state != CHARGING) {
-        resetLEDBlinkPattern();
+#ifdef ENABLE_CHARGE_MONITOR
+    chargeMonitorUpdate();
+#endif
+#ifdef ENABLE_CHARGE_TIME_TO_FULL_LED
+    if (chargeTimeToFullLED()) {
+        return;
     }
+#endif
+    Set_LED_RGB(0b001, 1023);
 }
 
-void chargingWait(void) {
-    if (detect == CHARGER) {
-        Set_LED_RGB(0b111, 1023);
+void chargingExit(void) {
+    ISL_SetSpecificBits(ISL.ENABLE_CHARGE_FET, 0);
+    charge_duration_counter.enable = false;
+    resetLEDBlinkPattern();
+}
+
+#ifdef ENABLE_TAPER_CHARGE_TERMINATION
+static uint16_t taper_peak_mV = 0;
+static uint16_t taper_last_mV = 0;
+static uint8_t taper_settled_samples = 0;
+static uint16_t taper_next_sample_tick = 0;
+
+// Follows the top cell down after the charge FET opens. Once it stops moving the sag from the end of the pulse tells
+// how much current was still flowing: little sag, or a relaxed voltage still near the limit, means the pack is full.
+static void _ChargeTaperSample(void) {
+    if (charge_wait_counter.value < taper_next_sample_tick) {
+        return;
     }
+    taper_next_sample_tick = (uint16_t) charge_wait_counter.value + CHARGING_WAIT_ACQUISITION_INTERVAL;
 
-    if (!charge_wait_counter.enable) {
-        charge_wait_counter.value = 0;
-        charge_wait_counter.enable = true;
-    } else if (charge_wait_counter.value >= CHARGE_WAIT_TIMEOUT) {
-        charge_wait_counter.enable = false;
-        state = CHARGING;
+    uint16_t top_mV = cellstats.maxcell_mV;
+    if (top_mV + TAPER_SETTLED_mV > taper_last_mV) {
+        taper_settled_samples++;
+    } else {
+        taper_settled_samples = 0;
     }
+    taper_last_mV = top_mV;
 
-    if (detect != CHARGER) {
-        charge_wait_counter.enable = false;
-        state = IDLE;
+    if (taper_settled_samples < TAPER_SETTLED_SAMPLES) {
+        return;
+    }
+    if (taper_peak_mV < top_mV + TAPER_FULL_SAG_mV || top_mV >= TAPER_FULL_RELAXED_mV) {
+        StateMachine_Event(COND_ACTION_DONE);       // Full, the transition table marks charge complete
+    } else {
+        StateMachine_Event(COND_CHARGE_WAIT_DONE);  // Relaxed but not full, pulse again
     }
+}
+#endif
+
+void chargingWaitEntry(void) {
+    charge_wait_counter.value = 0;
+    charge_wait_counter.enable = true;
+#ifdef ENABLE_CHARGE_MONITOR
+    chargeMonitorTopOfCharge();
+#endif
+#ifdef ENABLE_TAPER_CHARGE_TERMINATION
+    taper_peak_mV = cellstats.maxcell_mV;   // Last reading of the pulse that just ended
+    taper_last_mV = taper_peak_mV;
+    taper_settled_samples = 0;
+    taper_next_sample_tick = CHARGING_WAIT_ACQUISITION_INTERVAL;
+#endif
+}
 
-    if (!safetyChecks()) {
-        charge_wait_counter.enable = false;
-        state = ERROR;
+void chargingWait(void) {
+    if (detect == CHARGER) {
+        Set_LED_RGB(0b111, 1023);
     }
+#ifdef ENABLE_TAPER_CHARGE_TERMINATION
+    _ChargeTaperSample();
+#endif
 }
 
-void cellBalance(void) {
-    state = IDLE;
+void chargingWaitExit(void) {
+    charge_wait_counter.enable = false;
+}
+
+static uint8_t startup_led_step = 0;
+static bool runonce = false;
+static bool need_to_clear_LEDs_for_cell_voltage_indicator = true;
+
+void outputENEntry(void) {
+    startDischarge();
+    startup_led_step = 0;
+    need_to_clear_LEDs_for_cell_voltage_indicator = true;
+    runonce = false;
+    LED_code_cycle_counter.value = 0;
 }
 
 void outputEN(void) {
-    static uint8_t startup_led_step = 0;
-    static bool runonce = false;
-    static bool need_to_clear_LEDs_for_cell_voltage_indicator = true;
-
-    if (!ISL_GetSpecificBits_cached(ISL.ENABLE_DISCHARGE_FET)
-        && detect == TRIGGER
-        && ISL_GetSpecificBits_cached(ISL.WKUP_STATUS)
-        && minCellOK()
-        && safetyChecks()
-    ) {
-        ISL_SetSpecificBits(ISL.ENABLE_DISCHARGE_FET, 1);
-        startup_led_step = 0;
-        resetLEDBlinkPattern();
-        need_to_clear_LEDs_for_cell_voltage_indicator = true;
-        runonce = false;
-        total_runtime_counter.enable = true;
-        LED_code_cycle_counter.value = 0;
-    } else if (ISL_GetSpecificBits_cached(ISL.ENABLE_DISCHARGE_FET)
-        && detect == TRIGGER
-        && ISL_GetSpecificBits_cached(ISL.WKUP_STATUS)
-        && minCellOK()
-        && safetyChecks()
-    ) {
+    if (CONDITIONS_MET(COND_TRIGGER | COND_WKUP | COND_MIN_CELL_OK | COND_SAFETY_OK)) {
+        if (!CONDITIONS_MET(COND_DISCHARGE_FET)) {
+            outputENEntry();    // Trigger pulled again while the cell voltage indicator was showing
+            return;
+        }
         need_to_clear_LEDs_for_cell_voltage_indicator = true;
         runonce = false;
         if (startup_led_step < 3) {
@@ -416,15 +512,14 @@ void outputEN(void) {
                 Set_LED_RGB(0b001, 1023);
             }
         }
-    } else if (!minCellOK()) {
-        full_discharge_flag = true;
-        ISL_SetSpecificBits(ISL.ENABLE_DISCHARGE_FET, 0);
-        state = IDLE;
-    } else if (!safetyChecks()) {
-        ISL_SetSpecificBits(ISL.ENABLE_DISCHARGE_FET, 0);
-        state = ERROR;
-    } else if (detect == CHARGER) {
+        return;
+    }
+
+    if (CONDITIONS_MET(COND_DISCHARGE_FET)) {
         ISL_SetSpecificBits(ISL.ENABLE_DISCHARGE_FET, 0);
+    }
+
+    if (detect == CHARGER) {
         need_to_clear_LEDs_for_cell_voltage_indicator = true;
         if (!runonce) {
             resetLEDBlinkPattern();
@@ -434,137 +529,84 @@ void outputEN(void) {
         uint8_t num_blinks = ASCII_FIRMWARE_VERSION - '0';
         ledBlinkpattern(num_blinks, 0b111, 500, 500, 1000, 1000, 0);
         if (LED_code_cycle_counter.value > 1) {
-            state = IDLE;
+            StateMachine_Event(COND_ACTION_DONE);
         }
     } else {
-        ISL_SetSpecificBits(ISL.ENABLE_DISCHARGE_FET, 0);
         runonce = false;
         if (need_to_clear_LEDs_for_cell_voltage_indicator) {
             resetLEDBlinkPattern();
             need_to_clear_LEDs_for_cell_voltage_indicator = false;
         }
         if (cellVoltageLEDIndicator()) {
-            state = IDLE;
+            StateMachine_Event(COND_ACTION_DONE);
         }
     }
+}
 
-    if (state != OUTPUT_EN) {
-        total_runtime_counter.enable = false;
-        WriteTotalRuntimeCounterToEEPROM(EEPROM_RUNTIME_TOTAL_STARTING_ADDR);
-        startup_led_step = 0;
-        runonce = false;
-        need_to_clear_LEDs_for_cell_voltage_indicator = true;
-        resetLEDBlinkPattern();
-    }
+void outputENExit(void) {
+    ISL_SetSpecificBits(ISL.ENABLE_DISCHARGE_FET, 0);
+    total_runtime_counter.enable = false;
+    PROFILE_START(PHASE_EEPROM);
+    EEPROMLog_CommitRuntime(total_runtime_counter.value);
+#ifdef ENABLE_USAGE_HISTOGRAMS
+    Histograms_EndDischarge();
+#endif
+    PROFILE_STOP(PHASE_EEPROM);
+    startup_led_step = 0;
+    runonce = false;
+    need_to_clear_LEDs_for_cell_voltage_indicator = true;
+    resetLEDBlinkPattern();
 }
 
-void error(void) {
+static bool EEPROM_Event_Logged = false;
+static bool full_discharge_trigger_error = false;
+
+void errorEntry(void) {
     ISL_Write_Register(FETControl, 0b00000000);
+#ifdef ENABLE_CHARGE_MONITOR
+    chargeMonitorSessionEnd((past_error_reason & ERR_TEMP_MASK) ? CHARGE_END_TEMPERATURE : CHARGE_END_FAULT);
+#endif
 
     if (total_runtime_counter.enable) {
         total_runtime_counter.enable = false;
-        WriteTotalRuntimeCounterToEEPROM(EEPROM_RUNTIME_TOTAL_STARTING_ADDR);
+        PROFILE_START(PHASE_EEPROM);
+        EEPROMLog_CommitRuntime(total_runtime_counter.value);
+        PROFILE_STOP(PHASE_EEPROM);
     }
 
-    static bool EEPROM_Event_Logged = false;
-
-    current_error_reason = (error_reason_t){0};
-    setErrorReasonFlags(&current_error_reason); // ???????
-    static bool full_discharge_trigger_error = false;
     if (detect == TRIGGER && full_discharge_flag) {
         full_discharge_trigger_error = true;
     }
 
-    static bool critical_i2c_error = false;
     if (I2C_error_counter >= CRITICAL_I2C_ERROR_THRESH) {
-        critical_i2c_error = true;
+        past_error_reason |= ERR_CRITICAL_I2C;
     }
 
     if (!EEPROM_Event_Logged && !full_discharge_trigger_error) {
-        const uint8_t byte_size_of_event_log = 6;
-        uint8_t starting_write_addr = DATAEE_ReadByte(EEPROM_NEXT_BYTE_AVAIL_STORAGE_ADDR);
-
-        uint8_t data_byte_1 = 0;
-        data_byte_1 |= past_error_reason.ISL_INT_OVERTEMP_FLAG << 7;
-        data_byte_1 |= past_error_reason.ISL_EXT_OVERTEMP_FLAG << 6;
-        data_byte_1 |= past_error_reason.ISL_INT_OVERTEMP_PICREAD << 5;
-        data_byte_1 |= past_error_reason.THERMISTOR_OVERTEMP_PICREAD << 4;
-        data_byte_1 |= past_error_reason.UNDERTEMP_FLAG << 3;
-        data_byte_1 |= past_error_reason.CHARGE_OC_FLAG << 2;
-        data_byte_1 |= past_error_reason.DISCHARGE_OC_FLAG << 1;
-        data_byte_1 |= past_error_reason.DISCHARGE_SC_FLAG;
-
-        uint8_t data_byte_2 = 0;
-        data_byte_2 |= past_error_reason.DISCHARGE_OC_SHUNT_PICREAD << 7;
-        data_byte_2 |= past_error_reason.CHARGE_ISL_INT_OVERTEMP_PICREAD << 6;
-        data_byte_2 |= past_error_reason.CHARGE_THERMISTOR_OVERTEMP_PICREAD << 5;
-        data_byte_2 |= past_error_reason.TEMP_HYSTERESIS << 4;
-        data_byte_2 |= past_error_reason.ISL_BROWN_OUT << 3;
-        data_byte_2 |= critical_i2c_error << 2;
-        data_byte_2 |= (past_error_reason.DETECT_MODE & 0b00000011);
-
-        DATAEE_WriteByte(starting_write_addr, data_byte_1);
-        DATAEE_WriteByte(starting_write_addr+1, data_byte_2);
-        WriteTotalRuntimeCounterToEEPROM(starting_write_addr+2);
-
-        uint8_t future_starting_write_addr = EEPROM_START_OF_EVENT_LOGS_ADDR;
-        if (starting_write_addr + byte_size_of_event_log + byte_size_of_event_log - 1 <= 255) {
-            future_starting_write_addr = starting_write_addr + byte_size_of_event_log;
-        }
-
-        DATAEE_WriteByte(EEPROM_NEXT_BYTE_AVAIL_STORAGE_ADDR, future_starting_write_addr);
+        PROFILE_START(PHASE_EEPROM);
+        EEPROMLog_LogEvent(past_error_reason, StateMachine_PreviousState());
         EEPROM_Event_Logged = true;
+        PROFILE_STOP(PHASE_EEPROM);
     }
+}
 
-    if (critical_i2c_error || past_error_reason.ISL_BROWN_OUT) {
-        resetLEDBlinkPattern();
-        while (1) {
-            ISL_Write_Register(FETControl, 0b00000000);
-            if (I2C_ERROR_FLAGS != 0) {
-                I2C1_Init();
-                ClearI2CBus();
-            }
-
-            if (!detect) {
-                LED_code_cycle_counter.enable = true;
-            } else {
-                LED_code_cycle_counter.value = 0;
-                LED_code_cycle_counter.enable = false;
-            }
-
-            if (LED_code_cycle_counter.value > NUM_OF_LED_CODES_AFTER_FAULT_CLEAR) {
-                RESET();
-            }
-
-            if (past_error_reason.ISL_BROWN_OUT) {
-                ledBlinkpattern(16, 0b100, 500, 500, 1000, 1000, 0);
-            } else {
-                ledBlinkpattern(15, 0b100, 500, 500, 1000, 1000, 0);
-            }
+void error(void) {
+    ISL_Write_Register(FETControl, 0b00000000);
+#ifdef ENABLE_COMPARATOR_OC_TRIP
+    comparatorOCRearm();    // Any trip is latched in past_error_reason by now. The fault clears on the live shunt reading.
+#endif
 
-            if (TMR4_HasOverflowOccured()) {
-                if (nonblocking_wait_counter.enable) {
-                    nonblocking_wait_counter.value++;
-                }
-            }
+    current_error_reason = 0;
+    setErrorReasonFlags(&current_error_reason); // ???????
+    if (detect == TRIGGER && full_discharge_flag) {
+        full_discharge_trigger_error = true;
+    }
 
-            CLRWDT();
-            detect = checkDetect();
-        }
+    if (I2C_error_counter >= CRITICAL_I2C_ERROR_THRESH) {
+        past_error_reason |= ERR_CRITICAL_I2C;
     }
 
-    if (!current_error_reason.ISL_INT_OVERTEMP_FLAG
-        && !current_error_reason.ISL_EXT_OVERTEMP_FLAG
-        && !current_error_reason.ISL_INT_OVERTEMP_PICREAD
-        && !current_error_reason.THERMISTOR_OVERTEMP_PICREAD
-        && !current_error_reason.UNDERTEMP_FLAG
-        && !current_error_reason.CHARGE_OC_FLAG
-        && !current_error_reason.DISCHARGE_OC_FLAG
-        && !current_error_reason.DISCHARGE_SC_FLAG
-        && !current_error_reason.DISCHARGE_OC_SHUNT_PICREAD
-        && !current_error_reason.CHARGE_ISL_INT_OVERTEMP_PICREAD
-        && !current_error_reason.CHARGE_THERMISTOR_OVERTEMP_PICREAD
-        && !current_error_reason.TEMP_HYSTERESIS
+    if ((current_error_reason & ERR_FAULT_MASK) == 0
         && ((detect == NONE) || (full_discharge_trigger_error && detect == CHARGER))
         && discharge_current_mA == 0
     ) {
@@ -581,14 +623,7 @@ void error(void) {
                 && LED_code_cycle_counter.enable
                 && LED_code_cycle_counter.value > NUM_OF_LED_CODES_AFTER_FAULT_CLEAR
         ) {
-            error_timeout_wait_counter.enable = false;
-            sleep_timeout_counter.enable = false;
-            past_error_reason = (error_reason_t){0};
-            current_error_reason = (error_reason_t){0};
-            resetLEDBlinkPattern();
-            full_discharge_trigger_error = false;
-            EEPROM_Event_Logged = false;
-            state = IDLE;
+            StateMachine_Event(COND_ACTION_DONE);   // Fault cleared, the transition table moves us to IDLE
             return;
         }
     } else {
@@ -596,28 +631,12 @@ void error(void) {
         LED_code_cycle_counter.enable = false;
     }
 
-    if (past_error_reason.ISL_INT_OVERTEMP_FLAG ||
-        past_error_reason.ISL_INT_OVERTEMP_PICREAD ||
-        past_error_reason.THERMISTOR_OVERTEMP_PICREAD ||
-        past_error_reason.CHARGE_ISL_INT_OVERTEMP_PICREAD ||
-        past_error_reason.CHARGE_THERMISTOR_OVERTEMP_PICREAD) {
-        ledBlinkpattern(0, 0b110, 500, 500, 0, 0, 0);
-    } else if (past_error_reason.ISL_EXT_OVERTEMP_FLAG) {
-        ledBlinkpattern(5, 0b100, 500, 500, 1000, 1000, 0);
-    } else if (past_error_reason.CHARGE_OC_FLAG) {
-        ledBlinkpattern(8, 0b100, 500, 500, 1000, 1000, 0);
-    } else if (past_error_reason.DISCHARGE_OC_FLAG) {
-        ledBlinkpattern(9, 0b100, 500, 500, 1000, 1000, 0);
-    } else if (past_error_reason.DISCHARGE_SC_FLAG) {
-        ledBlinkpattern(10, 0b100, 500, 500, 1000, 1000, 0);
-    } else if (past_error_reason.DISCHARGE_OC_SHUNT_PICREAD) {
-        ledBlinkpattern(11, 0b100, 500, 500, 1000, 1000, 0);
-    } else if (past_error_reason.UNDERTEMP_FLAG) {
-        ledBlinkpattern(14, 0b100, 500, 500, 1000, 1000, 0);
-    } else if (full_discharge_trigger_error) {
-        ledBlinkpattern(3, 0b001, 300, 300, 750, 750, 0);
-    } else {
-        ledBlinkpattern(0, 0b100, 500, 500, 0, 0, 0);
+    if (!faultLEDCode(past_error_reason)) {
+        if (full_discharge_trigger_error) {
+            ledBlinkpattern(3, 0b001, 300, 300, 750, 750, 0);
+        } else {
+            ledBlinkpattern(0, 0b100, 500, 500, 0, 0, 0);
+        }
     }
 
     if (!sleep_timeout_counter.enable && detect != CHARGER) {
@@ -625,16 +644,66 @@ void error(void) {
         sleep_timeout_counter.enable = true;
     } else if (detect == CHARGER) {
         sleep_timeout_counter.enable = false;
-    } else if (sleep_timeout_counter.value > ERROR_SLEEP_TIMEOUT
-        && sleep_timeout_counter.enable
-        && !nonblocking_wait_counter.enable
-        && nonblocking_wait_counter.value == 0
-        && detect != CHARGER
-    ) {
-        sleep_timeout_counter.enable = false;
-        state = SLEEP;
     }
 }
+
+void errorExit(void) {
+    error_timeout_wait_counter.enable = false;
+    sleep_timeout_counter.enable = false;
+    resetLEDBlinkPattern();
+}
+
+void clearErrors(void) {
+    past_error_reason = 0;
+    current_error_reason = 0;
+    full_discharge_trigger_error = false;
+    EEPROM_Event_Logged = false;
+}
+
+static uint8_t critical_retry_interval = 1;
+static uint8_t critical_codes_since_release = 0;
+
+void criticalErrorEntry(void) {
+    resetLEDBlinkPattern();
+    LED_code_cycle_counter.enable = false;
+    critical_codes_since_release = 0;
+    critical_retry_interval = 1;
+    critical_retry_counter.value = 0;
+    critical_retry_counter.enable = true;
+}
+
+void criticalError(void) {
+    // Keep forcing the FETs off, backing off while the bus keeps failing so we don't hammer it
+    if (critical_retry_counter.value >= critical_retry_interval) {
+        critical_retry_counter.value = 0;
+        ISL_Write_Register(FETControl, 0b00000000);
+        if (I2C_ERROR_FLAGS != 0) {
+            I2C1_Init();
+            ClearI2CBus();
+            if (critical_retry_interval < CRITICAL_RETRY_MAX_TICKS) {
+                critical_retry_interval <<= 1;
+            }
+        } else {
+            critical_retry_interval = CRITICAL_RETRY_MAX_TICKS;
+        }
+    }
+
+    // Reset after the code has been shown a few times with the trigger and charger released
+    if (detect != NONE) {
+        critical_codes_since_release = 0;
+    } else if (!nonblocking_wait_counter.enable) {     // A new code cycle starts on this call
+        critical_codes_since_release++;
+        if (critical_codes_since_release > NUM_OF_LED_CODES_AFTER_FAULT_CLEAR) {
+#ifdef ENABLE_USAGE_HISTOGRAMS
+            Histograms_Flush();
+#endif
+            EEPROMLog_Flush();
+            RESET();
+        }
+    }
+    faultLEDCode(past_error_reason);
+}
+
 void RecordDetectHistory(void) {
     detect_history = (uint8_t) ((uint8_t)(detect_history << 2) | (detect & 0b00000011));
 }
@@ -652,52 +721,237 @@ bool CheckStateInDetectHistory(detect_t detect_val) {
     return false;
 }
 
-void WriteTotalRuntimeCounterToEEPROM(uint8_t starting_addr) {
-    DATAEE_WriteByte(starting_addr, (uint8_t) ((total_runtime_counter.value >> 24) & 0xFF));
-    DATAEE_WriteByte(starting_addr+1, (uint8_t) ((total_runtime_counter.value >> 16) & 0xFF));
-    DATAEE_WriteByte(starting_addr+2, (uint8_t) ((total_runtime_counter.value >> 8) & 0xFF));
-    DATAEE_WriteByte(starting_addr+3, (uint8_t) (total_runtime_counter.value & 0xFF));
+static uint8_t acquisitionInterval(state_t current_state) {
+    switch (current_state) {
+        case IDLE:
+            return IDLE_ACQUISITION_INTERVAL;
+        case CHARGING_WAIT:
+            return CHARGING_WAIT_ACQUISITION_INTERVAL;
+        case CELL_BALANCE:
+            return CELL_BALANCE_ACQUISITION_INTERVAL;
+        case ERROR:
+            return ERROR_ACQUISITION_INTERVAL;
+        default:
+            return 0;   // Every iteration
+    }
+}
+
+// The balance switches pull the cells they bleed down, so cells are only read once they have been off and settled.
+// Temperatures and status are still read every interval while the switches are on.
+static bool cellScanDue(void) {
+    return (state != CELL_BALANCE || cellBalanceMeasurementDue());
+}
+
+bool acquisitionDue(void) {
+    static state_t last_state = INIT;
+    static detect_t last_detect = NONE;
+    if (state == CRITICAL_ERROR) {
+        return false;   // ISL data can't be trusted and criticalError() owns the bus
+    }
+    uint8_t interval = acquisitionInterval(state);
+
+    bool due = (interval == 0
+        || acquisition_wait_counter.value >= interval
+        || (faultsPending() && acquisition_wait_counter.value >= 1)     // Confirm it within the debounce window
+        || state != last_state
+        || detect != last_detect
+        || (state == CELL_BALANCE && cellBalanceMeasurementDue()));    // The settled window can't wait for the interval
+
+    if (due) {
+        acquisition_wait_counter.value = 0;
+        acquisition_wait_counter.enable = true;
+    }
+    last_state = state;
+    last_detect = detect;
+    return due;
 }
 
+void AdvanceTickCounters(uint8_t ticks) {
+    if (charge_wait_counter.enable) {
+        charge_wait_counter.value += ticks;
+    }
+    if (charge_duration_counter.enable) {
+        charge_duration_counter.value += ticks;
+    }
+    if (sleep_timeout_counter.enable) {
+        sleep_timeout_counter.value += ticks;
+    }
+    if (nonblocking_wait_counter.enable) {
+        nonblocking_wait_counter.value += ticks;
+        ledAdvanceFade(ticks);
+    }
+    if (error_timeout_wait_counter.enable) {
+        error_timeout_wait_counter.value += ticks;
+    }
+    if (total_runtime_counter.enable) {
+        total_runtime_counter.value += ticks;
+    }
+    if (LED_code_cycle_counter.enable) {
+        LED_code_cycle_counter.value += ticks;
+    }
+    if (acquisition_wait_counter.enable) {
+        acquisition_wait_counter.value += ticks;
+    }
+    if (discharge_ready_age_counter.enable) {
+        discharge_ready_age_counter.value += ticks;
+    }
+    if (critical_retry_counter.enable) {
+        critical_retry_counter.value += ticks;
+    }
+    if (balance_cycle_counter.enable) {
+        balance_cycle_counter.value += ticks;
+    }
+    if (charge_session_counter.enable) {
+        charge_session_counter.value += ticks;
+    }
+    if (uptime_counter.enable) {
+        uptime_counter.value += ticks;
+    }
+#ifdef ENABLE_USAGE_HISTOGRAMS
+    Histograms_Tick(ticks);
+#endif
+}
+
+void lowPowerWait(void) {
+#ifdef __DEBUG_DONT_SLEEP
+    return;
+#endif
+    if (state != IDLE && state != CHARGING_WAIT && state != ERROR && state != CRITICAL_ERROR) {
+        return;
+    }
+
+    // TMR4 and the PWM clock stop during SLEEP, so only sleep for a single tick while an LED pattern is running.
+    // IDLE also wakes every tick: a trigger pull can't wake the PIC (see armDetectWake()), so the WDT bounds its latency.
+    uint8_t ticks = LED_IDLE_SLEEP_TICKS;
+    CLRWDT();
+    if (state == IDLE || nonblocking_wait_counter.enable || faultsPending() || EEPROMLog_Service()) {    // Start the next queued EEPROM write a tick from now
+        ticks = LED_ACTIVE_SLEEP_TICKS;
+        WDTCONbits.WDTPS = WDT_PERIOD_32ms;
+    } else {
+        WDTCONbits.WDTPS = WDT_PERIOD_256ms;
+    }
+
+#ifdef ENABLE_DETECT_IOC_WAKE
+    armDetectWake();
+#endif
+    SLEEP();
+    NOP();
+#ifdef ENABLE_DETECT_IOC_WAKE
+    if (disarmDetectWake()) {
+        ticks = 1;  // Woken early. The next pass sees the new detect value and forces an acquisition.
+    }
+#endif
+
+    WDTCONbits.WDTPS = WDT_PERIOD_512ms;
+    CLRWDT();
+    AdvanceTickCounters(ticks);
+}
+
+#if defined(ENABLE_COMPARATOR_OC_TRIP) || defined(ENABLE_LOOP_PROFILER)
+void __interrupt() ISR(void) {
+#ifdef ENABLE_COMPARATOR_OC_TRIP
+    if (PIE2bits.C1IE && PIR2bits.C1IF) {
+        comparatorOCInterrupt();
+    }
+#endif
+#ifdef ENABLE_LOOP_PROFILER
+    if (PIE1bits.TMR1IE && PIR1bits.TMR1IF) {
+        Profiler_TimerOverflow();
+    }
+#endif
+    if (INTCONbits.IOCIE && INTCONbits.IOCIF) {
+        INTCONbits.IOCIE = 0;   // Detect wake from SLEEP. IOCF_DETECT is left set for disarmDetectWake().
+    }
+}
+#endif
+
 void main(void) {
     init();
 
     while (1) {
         CLRWDT();
+#ifdef ENABLE_COMPARATOR_OC_TRIP
+        ISL_DischargeCutoffService();   // Trips while the bus was idle, e.g. across lowPowerWait()
+#endif
 #ifdef __DEBUG
         loop_counter++;
 #endif
+#ifdef ENABLE_LOOP_PROFILER
+        Profiler_LoopStart();
+#endif
 
-    ISL_Read_Register(AnalogOut);
-    ISL_Read_Register(FeatureSet);
-    ISL_BrownOutHandler();
-
-    ISL_ReadAllCellVoltages();
-    ISL_calcCellStats();
+    PROFILE_START(PHASE_DETECT);
     RecordDetectHistory();
     detect = checkDetect();
-    isl_int_temp = ISL_GetInternalTemp();
+    PROFILE_STOP(PHASE_DETECT);
+
+#ifdef ENABLE_FAST_TRIGGER_PATH
+    // Trigger edge while IDLE: enable output on the last background verdict. outputEN() confirms it with fresh data this pass.
+    // The edge is seen here on the first pass after the one-tick IDLE sleep in lowPowerWait().
+    if (state == IDLE && detect == TRIGGER && GetDetectHistory(0) != TRIGGER && dischargeReady()) {
+        ISL_Read_Register(Config);  // WKUP has to confirm the trigger, as on the table's IDLE to OUTPUT_EN row
+        if (ISL_GetSpecificBits_cached(ISL.WKUP_STATUS)) {
+            StateMachine_Transition(OUTPUT_EN);
+        }
+    }
+#endif
 
-    // ?? getThermistorTemp ??
-    uint16_t voltage_mV = 250; // TODO: ????? ADC ???????mV?
-    thermistor_temp = getThermistorTemp(voltage_mV);
+    bool acquired = acquisitionDue();
+    if (acquired) {
+        PROFILE_START(PHASE_ISL_REGISTERS);
+        ISL_Read_Register(AnalogOut);
+        ISL_Read_Register(FeatureSet);
+        ISL_BrownOutHandler();
+        PROFILE_STOP(PHASE_ISL_REGISTERS);
+
+        bool scan_complete = false;
+        bool scan_aborted = false;
+        if (cellScanDue()) {
+            PROFILE_START(PHASE_CELL_SCAN);
+            scan_complete = ISL_ReadAllCellVoltages();
+            scan_aborted = !scan_complete;
+            PROFILE_STOP(PHASE_CELL_SCAN);
+        }
+
+        // Read after an aborted scan too. One overcurrent sample aborts it, but the shunt filter needs several to trip.
+        PROFILE_START(PHASE_TEMPERATURE);
+        isl_int_temp = ISL_GetInternalTemp();
+
+        // ?? getThermistorTemp ??
+        uint16_t voltage_mV = 250; // TODO: ????? ADC ???????mV?
+        thermistor_temp = getThermistorTemp(voltage_mV);
 
 #ifdef __DEBUG_DISABLE_PIC_THERMISTOR_READ
-    thermistor_temp = 25;
+        thermistor_temp = 25;
 #endif
 
 #ifdef __DEBUG_DISABLE_PIC_ISL_INT_READ
-    isl_int_temp = 25;
+        isl_int_temp = 25;
 #endif
+        PROFILE_STOP(PHASE_TEMPERATURE);
+
+        PROFILE_START(PHASE_ISL_REGISTERS);
+        ISL_Read_Register(Config);
+        ISL_Read_Register(Status);
+        ISL_Read_Register(FETControl);
+        ISL_Read_Register(AnalogOut);
+        ISL_Read_Register(FeatureSet);
+        if (!scan_aborted) {
+            discharge_current_mA = dischargeIsense_mA();    // After an aborted scan keep the sample that crossed the limit
+        }
+        if (discharge_current_mA > peak_discharge_current_mA) {
+            peak_discharge_current_mA = discharge_current_mA;
+        }
+        PROFILE_STOP(PHASE_ISL_REGISTERS);
+        updateCellResistance(scan_complete);
+#ifdef ENABLE_CELL_HEALTH_LOG
+        CellHealth_Sample(scan_complete);
+#endif
+    }
 
-    ISL_Read_Register(Config);
-    ISL_Read_Register(Status);
-    ISL_Read_Register(FETControl);
-    ISL_Read_Register(AnalogOut);
-    ISL_Read_Register(FeatureSet);
-    discharge_current_mA = dischargeIsense_mA();
-
-    if (ISL_BrownOutHandler()) {
+    if (state == CRITICAL_ERROR) {
+            // Latched until RESET. criticalError() handles its own I2C recovery.
+        } else if (ISL_BrownOutHandler()) {
             // Do nothing
         } else if (I2C_ERROR_FLAGS != 0) {
             I2C_error_counter++;
@@ -708,61 +962,36 @@ void main(void) {
             } else {
                 I2C1_Init();
                 ClearI2CBus();
-                state = ERROR;
+                StateMachine_Transition(ERROR);
             }
         } else {
             I2C_error_counter = 0;
         }
 
-        switch(state) {
-            case INIT:
-                init();
-                break;
-            case SLEEP:
-                sleep();
-                break;
-            case IDLE:
-                idle();
-                break;
-            case CHARGING:
-                charging();
-                break;
-            case CHARGING_WAIT:
-                chargingWait();
-                break;
-            case CELL_BALANCE:
-                cellBalance();
-                break;
-            case OUTPUT_EN:
-                outputEN();
-                break;
-            case ERROR:
-                error();
-                break;
+        evaluateSafety(acquired);
+        if (acquired) {
+            updateDischargeReadyFlag();
         }
 
+#ifdef ENABLE_LOOP_PROFILER
+        state_t loop_state = state;
+#endif
+        PROFILE_START(PHASE_STATE_HANDLER);
+        StateMachine_Run();
+        PROFILE_STOP(PHASE_STATE_HANDLER);
+
+        EEPROMLog_Service();
+
         if (TMR4_HasOverflowOccured()) {
-            if (charge_wait_counter.enable) {
-                charge_wait_counter.value++;
-            }
-            if (charge_duration_counter.enable) {
-                charge_duration_counter.value++;
-            }
-            if (sleep_timeout_counter.enable) {
-                sleep_timeout_counter.value++;
-            }
-            if (nonblocking_wait_counter.enable) {
-                nonblocking_wait_counter.value++;
-            }
-            if (error_timeout_wait_counter.enable) {
-                error_timeout_wait_counter.value++;
-            }
-            if (total_runtime_counter.enable) {
-                total_runtime_counter.value++;
-            }
-            if (LED_code_cycle_counter.enable) {
-                LED_code_cycle_counter.value++;
-            }
+            AdvanceTickCounters(1);
         }
+
+#ifdef ENABLE_LOOP_PROFILER
+        Profiler_LoopEnd(loop_state);
+#endif
+
+#ifdef ENABLE_TICKLESS_IDLE
+        lowPowerWait();
+#endif
     }
 }
\ No newline at end of file
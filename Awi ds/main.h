@@ -38,6 +38,8 @@ typedef enum {
     CELL_BALANCE,     // ??????
     OUTPUT_EN,        // ??????
     ERROR,            // ????
+    CRITICAL_ERROR,   // Latched until RESET. I2C lost or ISL browned out.
+    NUM_OF_STATES,
 } state_t;
 
 typedef enum {
@@ -52,22 +54,32 @@ typedef enum {
     NUM_OF_MODELS,    // ????
 } modelnum_t;
 
-typedef struct {
-    bool ISL_INT_OVERTEMP_FLAG : 1;             // ISL ??????
-    bool ISL_EXT_OVERTEMP_FLAG : 1;             // ISL ??????
-    bool ISL_INT_OVERTEMP_PICREAD : 1;          // PIC ??? ISL ????
-    bool THERMISTOR_OVERTEMP_PICREAD : 1;       // PIC ?????????
-    bool UNDERTEMP_FLAG : 1;                    // ????
-    bool CHARGE_OC_FLAG : 1;                    // ??????
-    bool DISCHARGE_OC_FLAG : 1;                 // ??????
-    bool DISCHARGE_SC_FLAG : 1;                 // ??????
-    bool DISCHARGE_OC_SHUNT_PICREAD : 1;        // PIC ????????????
-    bool CHARGE_ISL_INT_OVERTEMP_PICREAD : 1;   // ??? ISL ????
-    bool CHARGE_THERMISTOR_OVERTEMP_PICREAD : 1; // ?????????
-    bool TEMP_HYSTERESIS : 1;                   // ??????
-    bool ISL_BROWN_OUT : 1;                     // ISL ????
-    uint8_t DETECT_MODE : 2;                    // ???? (NONE, TRIGGER, CHARGER)
-} error_reason_t;
+/* Error reasons are packed into one word. The bit layout matches the two event log bytes,
+ * high byte first, so a record is written as (reasons >> 8) then (reasons & 0xFF).
+ */
+typedef uint16_t error_reason_t;
+
+#define ERR_ISL_INT_OVERTEMP_FLAG               (1u << 15)  // ISL internal overtemp status flag
+#define ERR_ISL_EXT_OVERTEMP_FLAG               (1u << 14)  // ISL external overtemp status flag
+#define ERR_ISL_INT_OVERTEMP_PICREAD            (1u << 13)  // ISL internal temp read by the PIC over the discharge limit
+#define ERR_THERMISTOR_OVERTEMP_PICREAD         (1u << 12)  // Thermistor read by the PIC over the discharge limit
+#define ERR_UNDERTEMP_FLAG                      (1u << 11)  // Either temperature under MIN_TEMP_C
+#define ERR_CHARGE_OC_FLAG                      (1u << 10)  // ISL charge overcurrent status flag
+#define ERR_DISCHARGE_OC_FLAG                   (1u << 9)   // ISL discharge overcurrent status flag
+#define ERR_DISCHARGE_SC_FLAG                   (1u << 8)   // ISL short circuit status flag
+#define ERR_DISCHARGE_OC_SHUNT_PICREAD          (1u << 7)   // Shunt current read by the PIC over the limit
+#define ERR_CHARGE_ISL_INT_OVERTEMP_PICREAD     (1u << 6)   // ISL internal temp over the charge limit
+#define ERR_CHARGE_THERMISTOR_OVERTEMP_PICREAD  (1u << 5)   // Thermistor over the charge limit
+#define ERR_TEMP_HYSTERESIS                     (1u << 4)   // Temperature back in range but not past the hysteresis band
+#define ERR_ISL_BROWN_OUT                       (1u << 3)   // ISL lost its configuration
+#define ERR_CRITICAL_I2C                        (1u << 2)   // CRITICAL_I2C_ERROR_THRESH reached. Set by the error state, not measured.
+#define ERR_DETECT_MODE_MASK                    (0b11u)     // detect_t at the time the reasons were captured
+
+#define ERR_FAULT_MASK  (0xFFF0u)   // Faults that must all be clear before the error state can exit
+#define ERR_TEMP_MASK   (ERR_ISL_INT_OVERTEMP_FLAG | ERR_ISL_EXT_OVERTEMP_FLAG | ERR_ISL_INT_OVERTEMP_PICREAD \
+                        | ERR_THERMISTOR_OVERTEMP_PICREAD | ERR_CHARGE_ISL_INT_OVERTEMP_PICREAD \
+                        | ERR_CHARGE_THERMISTOR_OVERTEMP_PICREAD | ERR_UNDERTEMP_FLAG)
+#define ERR_DETECT_MODE(reasons) ((detect_t)((reasons) & ERR_DETECT_MODE_MASK))
 
 typedef struct {
     uint32_t value;  // ????
@@ -87,9 +99,17 @@ extern counter_t charge_wait_counter;
 extern counter_t nonblocking_wait_counter;
 extern counter_t error_timeout_wait_counter;
 extern counter_t LED_code_cycle_counter;
+extern counter_t acquisition_wait_counter;
+extern counter_t discharge_ready_age_counter;
+extern counter_t critical_retry_counter;
+extern counter_t balance_cycle_counter;
+extern counter_t charge_session_counter;
+extern counter_t uptime_counter;
 extern bool full_discharge_flag;
 extern bool charge_complete_flag;
+extern bool discharge_ready_flag;
 extern uint16_t discharge_current_mA;
+extern uint16_t peak_discharge_current_mA;
 extern int16_t isl_int_temp;
 extern int16_t thermistor_temp;
 extern uint8_t I2C_error_counter;
@@ -108,11 +128,43 @@ extern uint8_t I2C_error_counter;
 #define CRITICAL_I2C_ERROR_THRESH 2
 #define NUM_OF_LED_CODES_AFTER_FAULT_CLEAR 3
 #define PACK_CHARGE_NOT_COMPLETE_THRESH_mV 4100
+#define IDLE_ACQUISITION_INTERVAL 8
+#define CHARGING_WAIT_ACQUISITION_INTERVAL 16
+#define CELL_BALANCE_ACQUISITION_INTERVAL 16
+#define ERROR_ACQUISITION_INTERVAL 8
+#define LED_ACTIVE_SLEEP_TICKS 1
+#define LED_IDLE_SLEEP_TICKS 8
+#define DISCHARGE_READY_MAX_AGE 16
+#define CRITICAL_RETRY_MAX_TICKS 32
+#define BALANCE_ON_TICKS 250
+#define BALANCE_SETTLE_TICKS 16
+#define BALANCE_MAX_CYCLES 70     // Per charger connection
 
 detect_t GetDetectHistory(uint8_t position);
 bool CheckStateInDetectHistory(detect_t detect_val);
 uint16_t readADCmV(adc_channel_t channel);
-void WriteTotalRuntimeCounterToEEPROM(uint8_t starting_addr);
 void ClearI2CBus(void);
+void ADCPrepare(void);
+uint16_t dischargeIsense_mA(void);
+void init(void);
+void sleep(void);
+void idle(void);
+void idleExit(void);
+void markFullDischarge(void);
+void markChargeComplete(void);
+void charging(void);
+void chargingExit(void);
+void chargingWaitEntry(void);
+void chargingWait(void);
+void chargingWaitExit(void);
+void outputENEntry(void);
+void outputEN(void);
+void outputENExit(void);
+void errorEntry(void);
+void error(void);
+void errorExit(void);
+void clearErrors(void);
+void criticalErrorEntry(void);
+void criticalError(void);
 
 #endif /* MAIN_H */
\ No newline at end of file
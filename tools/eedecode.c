@@ -0,0 +1,793 @@
+/*
+
+AWI-Dyson-BMS - Dyson Battery Management System Configuration
+Copyright (C) 2025 AWi
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program. If not, see https://www.gnu.org/licenses/.
+Note: As an addendum to the GNU General Public License, any hardware
+using this project’s code or information must publicly disclose
+complete electrical schematics and a bill of materials for such hardware.
+Acknowledgements:
+Thanks to tinfever, the author of version 1, for compiling
+and open-sourcing it.
+Thanks to Dr. Mark Roberts for his contributions to the V8 open-source code.
+Contact: 112460193@qq.com | www.awi.design
+(Website is currently under maintenance) */
+
+/* Host side decoder for the BMS EEPROM read back from returned packs.
+ *
+ * Build:   cc -O2 -o eedecode eedecode.c
+ * Usage:   eedecode [-j | -c | -e] image...
+ *
+ *   -j  One JSON object per image per line (default)
+ *   -c  CSV, one summary row per image
+ *   -e  CSV, one row per logged event
+ *
+ * An image is either an Intel HEX file as written by MPLAB or a programmer (v6beta4.hex) or a raw 256 byte EEPROM dump.
+ * Both layouts are decoded: the original firmware's 6-byte records (layout 0) and the current one (LAYOUT_VERSION).
+ * The constants below mirror config.h, main.h, EEPROMLog.h, Histograms.h, CellHealth.h and ChargeMonitor.h.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define EEPROM_SIZE 256
+#define HEX_EEPROM_ADDR 0x1E000         // EEPROM at word 0xF000, one byte in the low half of each word
+
+#define TICKS_PER_HOUR 112500.0         // 32ms TMR4 ticks
+#define LAYOUT_VERSION 1
+#define LAYOUT_VERSION_ADDR 0x18
+#define LEGACY_POINTER_ADDR 0x19        // Layout 0
+#define LAYOUT_FEATURES_ADDR 0x19       // Regions present in the current layout
+#define LAST_CHARGE_SESSION_ADDR 0x1A
+#define LEGACY_RUNTIME_ADDR 0x1C
+#define EVENT_LOG_ADDR 0x20
+#define EVENT_DETAIL_ADDR 0xD0         // The optional regions are packed down from here in this order
+#define JOURNAL_ADDR 0xE0
+
+#define LEGACY_RECORD_SIZE 6
+#define EVENT_RECORD_SIZE 16
+#define JOURNAL_CHECKPOINT_SIZE 7
+#define JOURNAL_RING_SIZE 18
+#define JOURNAL_TICKS_PER_DELTA 64
+#define EVENT_BLOCKS 5                  // Sized to fill EVENT_LOG_ADDR up to the lowest optional region
+#define EVENT_BLOCK_HEADER_SIZE 5
+#define CHARGE_RECORD_SIZE 9
+#define CHARGE_RECORD_SLOTS 2
+#define CELL_CODE_BASE_mV 2000
+#define CELL_CODE_STEP_mV 10
+#define CURRENT_CODE_STEP_mA 250
+#define NUM_OF_STATES 9
+#define EVENT_DETAIL_SLOTS 1
+#define FEATURE_HISTOGRAMS 0x01
+#define FEATURE_CELL_HEALTH 0x02
+#define FEATURE_CHARGE_RECORDS 0x04
+#define HIST_SIZE 42
+#define CELL_HEALTH_SIZE 28
+#define HIST_STATE_FIRST 2              // IDLE to ERROR
+#define HIST_STATE_BINS 6
+#define HIST_DOD_OFFSET (18 + 2 * HIST_STATE_BINS)     // The counters after the depth of discharge bins follow at fixed offsets
+#define MAX_EVENTS 128
+
+typedef enum {
+    OUTPUT_JSON,
+    OUTPUT_SUMMARY_CSV,
+    OUTPUT_EVENT_CSV
+} output_t;
+
+typedef struct {
+    const char *source;     // Region the event was read from
+    uint16_t reason;        // error_reason_t
+    int state;              // state_t at the fault, -1 when the source doesn't keep it
+    uint32_t runtime_ticks;
+    uint16_t count;         // Repeats folded into this event
+    const uint8_t *detail;  // Full record, NULL for the short forms
+} event_t;
+
+typedef struct {
+    const char *path;
+    uint8_t eeprom[EEPROM_SIZE];
+    bool eeprom_found;
+    int layout;
+    uint8_t features;
+    int hist_addr;
+    int health_addr;
+    int charge_addr;
+    uint32_t runtime_ticks;
+    bool runtime_valid;
+    event_t events[MAX_EVENTS];
+    int num_events;
+} image_t;
+
+static const char *error_flag_names[16] = {
+    NULL, NULL, "CRITICAL_I2C", "ISL_BROWN_OUT", "TEMP_HYSTERESIS", "CHARGE_THERMISTOR_OVERTEMP_PICREAD",
+    "CHARGE_ISL_INT_OVERTEMP_PICREAD", "DISCHARGE_OC_SHUNT_PICREAD", "DISCHARGE_SC_FLAG", "DISCHARGE_OC_FLAG",
+    "CHARGE_OC_FLAG", "UNDERTEMP_FLAG", "THERMISTOR_OVERTEMP_PICREAD", "ISL_INT_OVERTEMP_PICREAD",
+    "ISL_EXT_OVERTEMP_FLAG", "ISL_INT_OVERTEMP_FLAG"
+};
+static const char *detect_names[4] = {"NONE", "TRIGGER", "CHARGER", "INVALID"};
+static const char *state_names[NUM_OF_STATES] = {
+    "INIT", "SLEEP", "IDLE", "CHARGING", "CHARGING_WAIT", "CELL_BALANCE", "OUTPUT_EN", "ERROR", "CRITICAL_ERROR"
+};
+static const char *charge_end_names[4] = {"complete", "removed", "temperature", "fault"};
+static const char *temp_bin_names[5] = {"below_0C", "0_20C", "20_35C", "35_50C", "above_50C"};
+static const char *current_bin_names[4] = {"below_5A", "5_10A", "10_20A", "above_20A"};
+static const char *dod_bin_names[3] = {"above_3600mV", "3300_3600mV", "below_3300mV"};
+
+static uint8_t crc8(const uint8_t *data, int length) {
+    uint8_t crc = 0;
+    while (length--) {
+        crc ^= *data++;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ 0x07) : (uint8_t)(crc << 1);
+        }
+    }
+    return crc;
+}
+
+static uint32_t be32(const uint8_t *p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static uint16_t be16(const uint8_t *p) {
+    return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+static int cell_mV(uint8_t code) {
+    return CELL_CODE_BASE_mV + code * CELL_CODE_STEP_mV;
+}
+
+/* ---- Input ---- */
+
+static int hex_nibble(int c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    return -1;
+}
+
+static bool load_hex(image_t *image, const char *text, size_t length) {
+    uint32_t base = 0;
+    size_t pos = 0;
+    while (pos < length) {
+        while (pos < length && text[pos] != ':') {
+            pos++;
+        }
+        if (pos >= length) {
+            break;
+        }
+        pos++;
+        uint8_t record[262];
+        int count = 0;
+        while (pos + 1 < length && count < (int)sizeof(record)) {
+            int high = hex_nibble(text[pos]);
+            int low = hex_nibble(text[pos + 1]);
+            if (high < 0 || low < 0) {
+                break;
+            }
+            record[count++] = (uint8_t)(high << 4 | low);
+            pos += 2;
+        }
+        if (count < 5 || count != record[0] + 5) {
+            fprintf(stderr, "%s: malformed HEX record\n", image->path);
+            return false;
+        }
+        uint8_t sum = 0;
+        for (int i = 0; i < count; i++) {
+            sum += record[i];
+        }
+        if (sum != 0) {
+            fprintf(stderr, "%s: HEX checksum error\n", image->path);
+            return false;
+        }
+
+        uint8_t type = record[3];
+        uint32_t addr = base + be16(&record[1]);
+        if (type == 0x00) {
+            for (int i = 0; i < record[0]; i++) {
+                uint32_t byte_addr = addr + i;
+                if (byte_addr & 1) {
+                    continue;   // High half of a word
+                }
+                if (byte_addr >= HEX_EEPROM_ADDR && byte_addr < HEX_EEPROM_ADDR + 2 * EEPROM_SIZE) {
+                    image->eeprom[(byte_addr - HEX_EEPROM_ADDR) / 2] = record[4 + i];
+                    image->eeprom_found = true;
+                }
+            }
+        } else if (type == 0x01) {
+            break;
+        } else if (type == 0x02) {
+            base = (uint32_t)be16(&record[4]) << 4;
+        } else if (type == 0x04) {
+            base = (uint32_t)be16(&record[4]) << 16;
+        }
+    }
+    return true;
+}
+
+static bool load_image(image_t *image, const char *path) {
+    memset(image, 0, sizeof(*image));
+    memset(image->eeprom, 0xFF, sizeof(image->eeprom));     // Erased EEPROM
+    image->path = path;
+
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        perror(path);
+        return false;
+    }
+    static char buffer[1 << 20];
+    size_t length = fread(buffer, 1, sizeof(buffer), file);
+    fclose(file);
+
+    size_t first = 0;
+    while (first < length && (buffer[first] == ' ' || buffer[first] == '\r' || buffer[first] == '\n')) {
+        first++;
+    }
+    if (first < length && buffer[first] == ':') {
+        if (!load_hex(image, buffer, length)) {
+            return false;
+        }
+        if (!image->eeprom_found) {
+            fprintf(stderr, "%s: no EEPROM data in HEX image, decoding it as erased\n", path);
+        }
+        return true;
+    }
+    if (length < EEPROM_SIZE) {
+        fprintf(stderr, "%s: raw dump shorter than %d bytes\n", path, EEPROM_SIZE);
+        return false;
+    }
+    memcpy(image->eeprom, buffer, EEPROM_SIZE);
+    image->eeprom_found = true;
+    return true;
+}
+
+/* ---- Decoding ---- */
+
+static event_t *add_event(image_t *image, const char *source, uint16_t reason, uint32_t runtime_ticks) {
+    if (image->num_events >= MAX_EVENTS) {
+        return NULL;
+    }
+    event_t *event = &image->events[image->num_events++];
+    *event = (event_t){source, reason, -1, runtime_ticks, 1, NULL};
+    return event;
+}
+
+// Same recovery as EEPROMLog_RecoverRuntime(), without repairing anything
+static bool decode_journal(const uint8_t *ee, uint32_t *runtime_ticks) {
+    const uint8_t *slot_a = &ee[JOURNAL_ADDR];
+    const uint8_t *slot_b = &ee[JOURNAL_ADDR + JOURNAL_CHECKPOINT_SIZE];
+    bool a_valid = crc8(slot_a, JOURNAL_CHECKPOINT_SIZE - 1) == slot_a[JOURNAL_CHECKPOINT_SIZE - 1];
+    bool b_valid = crc8(slot_b, JOURNAL_CHECKPOINT_SIZE - 1) == slot_b[JOURNAL_CHECKPOINT_SIZE - 1];
+    if (!a_valid && !b_valid) {
+        return false;
+    }
+    const uint8_t *checkpoint = slot_b;
+    if (a_valid && (!b_valid || (int8_t)(slot_a[0] - slot_b[0]) > 0)) {
+        checkpoint = slot_a;
+    }
+
+    uint32_t ticks = be32(&checkpoint[1]);
+    int index = checkpoint[5] & 0x7F;
+    int lap = checkpoint[5] & 0x80;
+    if (index >= JOURNAL_RING_SIZE) {
+        index = 0;
+    }
+    const uint8_t *ring = &ee[JOURNAL_ADDR + 2 * JOURNAL_CHECKPOINT_SIZE];
+    for (int count = 0; count < JOURNAL_RING_SIZE; count++) {
+        uint8_t delta = ring[index];
+        if ((delta & 0x80) != lap || (delta & 0x7F) == 0) {
+            break;
+        }
+        ticks += (uint32_t)(delta & 0x7F) * JOURNAL_TICKS_PER_DELTA;
+        if (++index >= JOURNAL_RING_SIZE) {
+            index = 0;
+            lap ^= 0x80;
+        }
+    }
+    *runtime_ticks = ticks;
+    return true;
+}
+
+// Layout 0: reason word and runtime, MSB first, in a ring up to the end of EEPROM whose next write address is kept at 0x19
+static void decode_legacy_records(image_t *image) {
+    const uint8_t *ee = image->eeprom;
+    int slots = 1;
+    for (int addr = EVENT_LOG_ADDR; addr + 2 * LEGACY_RECORD_SIZE <= EEPROM_SIZE; addr += LEGACY_RECORD_SIZE) {
+        slots++;    // error() moves on while the record after the next one would still fit
+    }
+    int next = (ee[LEGACY_POINTER_ADDR] - EVENT_LOG_ADDR) / LEGACY_RECORD_SIZE;
+    if (ee[LEGACY_POINTER_ADDR] < EVENT_LOG_ADDR || next >= slots) {
+        next = 0;
+    }
+    for (int i = 0; i < slots; i++) {
+        const uint8_t *record = &ee[EVENT_LOG_ADDR + ((next + i) % slots) * LEGACY_RECORD_SIZE];
+        bool zero = true;
+        bool erased = true;
+        for (int b = 0; b < LEGACY_RECORD_SIZE; b++) {
+            zero &= (record[b] == 0x00);
+            erased &= (record[b] == 0xFF);
+        }
+        if (!zero && !erased) {
+            add_event(image, "legacy", be16(record), be32(&record[2]));
+        }
+    }
+}
+
+static bool valid_event_record(const uint8_t *record) {
+    return (record[0] >> 4) == 1 && crc8(record, EVENT_RECORD_SIZE - 1) == record[EVENT_RECORD_SIZE - 1];
+}
+
+// Adds the valid full records of a slot ring, oldest first by their sequence number
+static void decode_event_records(image_t *image, const char *source, const uint8_t *base, int slots) {
+    int order[32];
+    int found = 0;
+    int newest = -1;
+    for (int slot = 0; slot < slots && found < 32; slot++) {
+        const uint8_t *record = &base[slot * EVENT_RECORD_SIZE];
+        if (!valid_event_record(record)) {
+            continue;
+        }
+        order[found++] = slot;
+        if (newest < 0 || (int8_t)(record[1] - base[newest * EVENT_RECORD_SIZE + 1]) >= 0) {
+            newest = slot;
+        }
+    }
+    if (found == 0) {
+        return;
+    }
+    uint8_t newest_seq = base[newest * EVENT_RECORD_SIZE + 1];
+    for (int i = 1; i < found; i++) {   // Oldest first: largest distance behind the newest sequence number
+        for (int j = i; j > 0; j--) {
+            uint8_t age_j = (uint8_t)(newest_seq - base[order[j] * EVENT_RECORD_SIZE + 1]);
+            uint8_t age_prev = (uint8_t)(newest_seq - base[order[j - 1] * EVENT_RECORD_SIZE + 1]);
+            if (age_j <= age_prev) {
+                break;
+            }
+            int swap = order[j];
+            order[j] = order[j - 1];
+            order[j - 1] = swap;
+        }
+    }
+    for (int i = 0; i < found; i++) {
+        const uint8_t *record = &base[order[i] * EVENT_RECORD_SIZE];
+        event_t *event = add_event(image, source, be16(&record[2]), be32(&record[4]));
+        if (event != NULL) {
+            event->state = record[0] & 0x0F;
+            event->detail = record;
+        }
+    }
+}
+
+// See the stream description in EEPROMLog.c
+static void decode_stream(image_t *image, int blocks, int block_size) {
+    const uint8_t *ee = image->eeprom;
+    int newest = -1;
+    for (int block = 0; block < blocks; block++) {
+        uint8_t seq = ee[EVENT_LOG_ADDR + block * block_size];
+        if (seq > 0x7F) {
+            continue;
+        }
+        if (newest < 0 || (int8_t)((uint8_t)(seq - ee[EVENT_LOG_ADDR + newest * block_size]) << 1) > 0) {
+            newest = block;
+        }
+    }
+    if (newest < 0) {
+        return;
+    }
+    uint8_t newest_seq = ee[EVENT_LOG_ADDR + newest * block_size];
+
+    for (int age = 0x7F; age >= 0; age--) {     // Oldest block first
+        for (int block = 0; block < blocks; block++) {
+            const uint8_t *start = &ee[EVENT_LOG_ADDR + block * block_size];
+            if (start[0] > 0x7F || ((newest_seq - start[0]) & 0x7F) != age) {
+                continue;
+            }
+            uint32_t units = be32(&start[1]);
+            event_t *last = NULL;
+            int pos = EVENT_BLOCK_HEADER_SIZE;
+            while (pos < block_size && start[pos] != 0xFF) {
+                uint8_t header = start[pos++];
+                if ((header & 0xC0) == 0x80) {
+                    if (last != NULL) {
+                        last->count += header & 0x3F;
+                    }
+                    continue;
+                }
+                if ((header & 0xC0) == 0xC0) {
+                    break;      // Never written
+                }
+                uint16_t reason = (header >> 4) & 0x03;
+                if ((header & 0xC0) == 0x00) {
+                    reason |= (uint16_t)(1u << (header & 0x0F));
+                } else {
+                    if (pos + 2 > block_size) {
+                        break;
+                    }
+                    reason |= be16(&start[pos]) & 0xFFFC;
+                    pos += 2;
+                }
+                uint32_t delta = 0;
+                int shift = 0;
+                uint8_t varint_byte;
+                do {
+                    varint_byte = start[pos++];
+                    delta |= (uint32_t)(varint_byte & 0x7F) << shift;
+                    shift += 7;
+                } while ((varint_byte & 0x80) && pos < block_size && shift < 32);
+                units += delta;
+                last = add_event(image, "stream", reason, units * JOURNAL_TICKS_PER_DELTA);
+            }
+        }
+    }
+}
+
+// Anything but LAYOUT_VERSION is layout 0, as EEPROMLog_Init() treats it
+static void decode(image_t *image) {
+    const uint8_t *ee = image->eeprom;
+    image->layout = (ee[LAYOUT_VERSION_ADDR] == LAYOUT_VERSION) ? LAYOUT_VERSION : 0;
+    if (image->layout == 0) {
+        image->runtime_ticks = be32(&ee[LEGACY_RUNTIME_ADDR]);
+        image->runtime_valid = (image->runtime_ticks != 0xFFFFFFFF);
+        decode_legacy_records(image);
+        return;
+    }
+    image->features = ee[LAYOUT_FEATURES_ADDR];
+    image->hist_addr = EVENT_DETAIL_ADDR - ((image->features & FEATURE_HISTOGRAMS) ? HIST_SIZE : 0);
+    image->health_addr = image->hist_addr - ((image->features & FEATURE_CELL_HEALTH) ? CELL_HEALTH_SIZE : 0);
+    image->charge_addr = image->health_addr
+        - ((image->features & FEATURE_CHARGE_RECORDS) ? CHARGE_RECORD_SLOTS * CHARGE_RECORD_SIZE : 0);
+
+    image->runtime_valid = decode_journal(ee, &image->runtime_ticks);
+    decode_stream(image, EVENT_BLOCKS, (image->charge_addr - EVENT_LOG_ADDR) / EVENT_BLOCKS);
+    decode_event_records(image, "detail", &ee[EVENT_DETAIL_ADDR], EVENT_DETAIL_SLOTS);
+}
+
+/* ---- Output ---- */
+
+static void print_json_string(const char *text) {
+    putchar('"');
+    for (; *text != '\0'; text++) {
+        unsigned char c = (unsigned char)*text;
+        if (c == '"' || c == '\\') {
+            printf("\\%c", c);
+        } else if (c < 0x20 || c >= 0x7F) {
+            printf("\\u%04x", c);
+        } else {
+            putchar(c);
+        }
+    }
+    putchar('"');
+}
+
+static void id_string(const image_t *image, char *out) {
+    int length = 0;
+    for (int i = 0; i < LAYOUT_VERSION_ADDR && image->eeprom[i] >= 0x20 && image->eeprom[i] < 0x7F; i++) {
+        out[length++] = (char)image->eeprom[i];
+    }
+    out[length] = '\0';
+}
+
+static void reason_flags(uint16_t reason, char *out, const char *separator) {
+    out[0] = '\0';
+    for (int bit = 15; bit >= 2; bit--) {
+        if (reason & (1u << bit)) {
+            if (out[0] != '\0') {
+                strcat(out, separator);
+            }
+            strcat(out, error_flag_names[bit]);
+        }
+    }
+}
+
+// Details repeat events the history already holds
+static bool history_event(const event_t *event) {
+    return strcmp(event->source, "detail") != 0;
+}
+
+static uint16_t counter(const image_t *image, int offset) {
+    return be16(&image->eeprom[image->hist_addr + offset]);
+}
+
+// Cell with the most cutoff min ranks, ties broken by the lowest cutoff deviation. 0 when nothing was counted yet.
+static int weakest_cell(const image_t *image) {
+    int weakest = 0;
+    int best_rank = 0;
+    int best_dev = 0;
+    for (int cell = 1; cell <= 6; cell++) {
+        const uint8_t *health = &image->eeprom[image->health_addr + (cell - 1) * 4];
+        int rank = health[3] >> 4;
+        int dev = (int8_t)health[1];
+        if (rank > best_rank || (rank == best_rank && rank != 0 && dev < best_dev)) {
+            weakest = cell;
+            best_rank = rank;
+            best_dev = dev;
+        }
+    }
+    return weakest;
+}
+
+static void print_json_event(const event_t *event) {
+    char flags[512];
+    reason_flags(event->reason, flags, "\",\"");
+    printf("{\"source\":\"%s\",\"reason\":\"0x%04X\",\"flags\":[%s%s%s],\"detect\":\"%s\",\"runtime_ticks\":%lu,"
+           "\"runtime_hours\":%.3f,\"count\":%u",
+           event->source, event->reason, flags[0] ? "\"" : "", flags, flags[0] ? "\"" : "",
+           detect_names[event->reason & 0x03], (unsigned long)event->runtime_ticks,
+           event->runtime_ticks / TICKS_PER_HOUR, event->count);
+    if (event->detail != NULL) {
+        const uint8_t *r = event->detail;
+        printf(",\"seq\":%u,\"state\":\"%s\",\"uptime_min\":%u,\"min_cell\":%u,\"min_cell_mV\":%d,\"max_cell\":%u,"
+               "\"max_cell_mV\":%d,\"isl_temp_C\":%d,\"thermistor_temp_C\":%d,\"peak_current_mA\":%d",
+               r[1], (event->state < NUM_OF_STATES) ? state_names[event->state] : "UNKNOWN", r[8], r[11] >> 4,
+               cell_mV(r[9]), r[11] & 0x0F, cell_mV(r[10]), (int8_t)r[12], (int8_t)r[13],
+               r[14] * CURRENT_CODE_STEP_mA);
+    }
+    putchar('}');
+}
+
+static void print_json_histograms(const image_t *image) {
+    printf(",\"histograms\":{\"temperature_min\":{");
+    for (int i = 0; i < 5; i++) {
+        printf("%s\"%s\":%u", i ? "," : "", temp_bin_names[i], counter(image, 2 * i));
+    }
+    printf("},\"discharge_current_8s\":{");
+    for (int i = 0; i < 4; i++) {
+        printf("%s\"%s\":%u", i ? "," : "", current_bin_names[i], counter(image, 10 + 2 * i));
+    }
+    printf("},\"state_min\":{");
+    for (int i = 0; i < HIST_STATE_BINS; i++) {
+        printf("%s\"%s\":%u", i ? "," : "", state_names[HIST_STATE_FIRST + i], counter(image, 18 + 2 * i));
+    }
+    printf("},\"depth_of_discharge\":{");
+    for (int i = 0; i < 3; i++) {
+        printf("%s\"%s\":%u", i ? "," : "", dod_bin_names[i], counter(image, HIST_DOD_OFFSET + 2 * i));
+    }
+    printf("},\"charge_cycles\":%u,\"discharged_Ah\":%.1f,\"discharged_Wh\":%u}",
+           counter(image, HIST_DOD_OFFSET + 6),
+           counter(image, HIST_DOD_OFFSET + 8) / 10.0, counter(image, HIST_DOD_OFFSET + 10));
+}
+
+static void print_json_cell_health(const image_t *image) {
+    const uint8_t *pack = &image->eeprom[image->health_addr + 24];
+    printf(",\"cell_health\":[");
+    for (int cell = 1; cell <= 6; cell++) {
+        const uint8_t *health = &image->eeprom[image->health_addr + (cell - 1) * 4];
+        printf("%s{\"cell\":%d,\"eoc_dev_mV\":%d,\"cutoff_dev_mV\":%d,", (cell > 1) ? "," : "", cell,
+               2 * (int8_t)health[0], 2 * (int8_t)health[1]);
+        if (health[2] != 0) {
+            printf("\"ir_mOhm\":%u,", health[2]);
+        } else {
+            printf("\"ir_mOhm\":null,");
+        }
+        printf("\"min_rank\":%u,\"max_rank\":%u}", health[3] >> 4, health[3] & 0x0F);
+    }
+    uint16_t cycles = 0;    // Completed charges, kept by the histograms
+    if (image->features & FEATURE_HISTOGRAMS) {
+        cycles = counter(image, HIST_DOD_OFFSET + 6);
+    }
+    printf("],\"pack_trend\":{\"cycles\":%u,\"weakest_cell\":%d", cycles, weakest_cell(image));
+    const char *names[2] = {"eoc", "cutoff"};
+    for (int i = 0; i < 2; i++) {
+        uint8_t base = pack[2 * i];
+        uint8_t average = pack[2 * i + 1];
+        if (base == 0xFF) {
+            printf(",\"%s_delta_base_mV\":null,\"%s_delta_avg_mV\":null", names[i], names[i]);
+            continue;
+        }
+        printf(",\"%s_delta_base_mV\":%d,\"%s_delta_avg_mV\":%d", names[i], 2 * base, names[i], 2 * average);
+        if (cycles != 0) {
+            printf(",\"%s_delta_growth_mV_per_cycle\":%.3f", names[i], 2.0 * (average - base) / cycles);
+        }
+    }
+    putchar('}');
+}
+
+static void print_json_charge_sessions(const image_t *image) {
+    const uint8_t *slots = &image->eeprom[image->charge_addr];
+    int newest = -1;
+    for (int slot = 0; slot < CHARGE_RECORD_SLOTS; slot++) {
+        uint8_t seq = slots[slot * CHARGE_RECORD_SIZE];
+        if (seq != 0xFF && (newest < 0 || seq == (slots[newest * CHARGE_RECORD_SIZE] + 1) % 0xFF)) {
+            newest = slot;
+        }
+    }
+    printf(",\"charge_sessions\":[");
+    bool first = true;
+    for (int i = 1; i <= CHARGE_RECORD_SLOTS && newest >= 0; i++) {   // Oldest first
+        const uint8_t *r = &slots[((newest + i) % CHARGE_RECORD_SLOTS) * CHARGE_RECORD_SIZE];
+        if (r[0] == 0xFF) {
+            continue;
+        }
+        printf("%s{\"seq\":%u,\"start_min_mV\":%d,\"start_max_mV\":%d,\"end_min_mV\":%d,\"end_max_mV\":%d,"
+               "\"minutes\":%u,\"end\":\"%s\",\"balanced\":%s,\"wait_pulses\":%u,\"peak_temp_C\":%d}",
+               first ? "" : ",", r[0], cell_mV(r[1]), cell_mV(r[2]), cell_mV(r[3]), cell_mV(r[4]),
+               (r[5] & 0x0F) << 8 | r[6], charge_end_names[r[5] >> 6], (r[5] & 0x20) ? "true" : "false", r[7],
+               (int8_t)r[8]);
+        first = false;
+    }
+    putchar(']');
+}
+
+static void print_json(const image_t *image) {
+    char id[LAYOUT_VERSION_ADDR + 1];
+    id_string(image, id);
+    printf("{\"file\":");
+    print_json_string(image->path);
+    printf(",\"id\":");
+    print_json_string(id);
+    printf(",\"layout\":%d", image->layout);
+    if (image->runtime_valid) {
+        printf(",\"runtime_ticks\":%lu,\"runtime_hours\":%.3f", (unsigned long)image->runtime_ticks,
+               image->runtime_ticks / TICKS_PER_HOUR);
+    } else {
+        printf(",\"runtime_ticks\":null,\"runtime_hours\":null");
+    }
+    printf(",\"events\":[");
+    for (int i = 0; i < image->num_events; i++) {
+        if (i > 0) {
+            putchar(',');
+        }
+        print_json_event(&image->events[i]);
+    }
+    putchar(']');
+
+    const uint8_t *last_charge = &image->eeprom[LAST_CHARGE_SESSION_ADDR];
+    if (image->layout == LAYOUT_VERSION) {
+        printf(",\"features\":\"0x%02X\"", image->features);
+    }
+    if (image->layout == LAYOUT_VERSION && (image->features & FEATURE_CHARGE_RECORDS)) {
+        if (last_charge[1] != 0xFF) {
+            printf(",\"last_charge\":{\"peak_current_mA\":%d,\"minutes\":%u}", last_charge[0] * 50, last_charge[1]);
+        }
+        print_json_charge_sessions(image);
+    }
+    if (image->layout == LAYOUT_VERSION && (image->features & FEATURE_HISTOGRAMS)) {
+        print_json_histograms(image);
+    }
+    if (image->layout == LAYOUT_VERSION && (image->features & FEATURE_CELL_HEALTH)) {
+        print_json_cell_health(image);
+    }
+    printf("}\n");
+}
+
+static void print_csv_field(const char *text) {
+    putchar('"');
+    for (; *text != '\0'; text++) {
+        if (*text == '"') {
+            putchar('"');
+        }
+        putchar(*text);
+    }
+    putchar('"');
+}
+
+static void print_summary_csv(const image_t *image) {
+    char id[LAYOUT_VERSION_ADDR + 1];
+    id_string(image, id);
+    unsigned events = 0;
+    const event_t *last = NULL;
+    for (int i = 0; i < image->num_events; i++) {
+        if (history_event(&image->events[i])) {
+            events += image->events[i].count;
+            last = &image->events[i];
+        }
+    }
+    print_csv_field(image->path);
+    putchar(',');
+    print_csv_field(id);
+    printf(",%d,", image->layout);
+    if (image->runtime_valid) {
+        printf("%.3f", image->runtime_ticks / TICKS_PER_HOUR);
+    }
+    printf(",%u,", events);
+    if (last != NULL) {
+        char flags[512];
+        reason_flags(last->reason, flags, "|");
+        print_csv_field(flags);
+    }
+    if (image->layout == LAYOUT_VERSION && (image->features & FEATURE_HISTOGRAMS)) {
+        printf(",%u,%.1f,%u", counter(image, HIST_DOD_OFFSET + 6),
+               counter(image, HIST_DOD_OFFSET + 8) / 10.0, counter(image, HIST_DOD_OFFSET + 10));
+    } else {
+        printf(",,,");
+    }
+    if (image->layout == LAYOUT_VERSION && (image->features & FEATURE_CELL_HEALTH)) {
+        const uint8_t *pack = &image->eeprom[image->health_addr + 24];
+        int weakest = weakest_cell(image);
+        printf(",%d,", weakest);
+        if (weakest != 0 && image->eeprom[image->health_addr + (weakest - 1) * 4 + 2] != 0) {
+            printf("%u", image->eeprom[image->health_addr + (weakest - 1) * 4 + 2]);
+        }
+        putchar(',');
+        if (pack[0] != 0xFF) {
+            printf("%d", 2 * pack[1]);
+        }
+        putchar(',');
+        if (pack[2] != 0xFF) {
+            printf("%d", 2 * pack[3]);
+        }
+    } else {
+        printf(",,,,");
+    }
+    putchar('\n');
+}
+
+static void print_event_csv(const image_t *image) {
+    for (int i = 0; i < image->num_events; i++) {
+        const event_t *event = &image->events[i];
+        char flags[512];
+        reason_flags(event->reason, flags, "|");
+        print_csv_field(image->path);
+        printf(",%d,%s,0x%04X,", i, event->source, event->reason);
+        print_csv_field(flags);
+        printf(",%s,%s,%lu,%.3f,%u\n", detect_names[event->reason & 0x03],
+               (event->state >= 0 && event->state < NUM_OF_STATES) ? state_names[event->state] : "",
+               (unsigned long)event->runtime_ticks, event->runtime_ticks / TICKS_PER_HOUR, event->count);
+    }
+}
+
+static void usage(void) {
+    fprintf(stderr, "usage: eedecode [-j | -c | -e] image...\n");
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    output_t output = OUTPUT_JSON;
+    int arg = 1;
+    for (; arg < argc && argv[arg][0] == '-'; arg++) {
+        if (strcmp(argv[arg], "-j") == 0) {
+            output = OUTPUT_JSON;
+        } else if (strcmp(argv[arg], "-c") == 0) {
+            output = OUTPUT_SUMMARY_CSV;
+        } else if (strcmp(argv[arg], "-e") == 0) {
+            output = OUTPUT_EVENT_CSV;
+        } else {
+            usage();
+        }
+    }
+    if (arg >= argc) {
+        usage();
+    }
+
+    if (output == OUTPUT_SUMMARY_CSV) {
+        printf("file,id,layout,runtime_hours,events,last_event_flags,charge_cycles,discharged_Ah,discharged_Wh,"
+               "weakest_cell,weakest_cell_ir_mOhm,eoc_delta_avg_mV,cutoff_delta_avg_mV\n");
+    } else if (output == OUTPUT_EVENT_CSV) {
+        printf("file,index,source,reason,flags,detect,state,runtime_ticks,runtime_hours,count\n");
+    }
+
+    static image_t image;
+    int status = 0;
+    for (; arg < argc; arg++) {
+        if (!load_image(&image, argv[arg])) {
+            status = 1;
+            continue;
+        }
+        decode(&image);
+        if (output == OUTPUT_JSON) {
+            print_json(&image);
+        } else if (output == OUTPUT_SUMMARY_CSV) {
+            print_summary_csv(&image);
+        } else {
+            print_event_csv(&image);
+        }
+    }
+    return status;
+}